@@ -0,0 +1,52 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* One JSON object per line so results can be diffed and graphed. */
+static inline void bench_report(const char* bench, const char* scenario, size_t bytes, uint64_t elapsed_ns) {
+    double seconds = elapsed_ns / 1e9;
+    double mb_per_s = seconds > 0 ? (bytes / (1024.0 * 1024.0)) / seconds : 0.0;
+    printf("{\"bench\":\"%s\",\"scenario\":\"%s\",\"bytes\":%zu,\"ns\":%llu,\"mb_per_s\":%.1f,\"gb_per_s\":%.2f}\n",
+           bench, scenario, bytes, (unsigned long long)elapsed_ns, mb_per_s, mb_per_s / 1024.0);
+    fflush(stdout);
+}
+
+/* Fills path with size bytes of lowercase lines of 0-99 characters. */
+static inline int bench_write_sample_file(const char* path, size_t size) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        perror("Failed to create sample file");
+        return -1;
+    }
+
+    char line[256];
+    size_t written = 0;
+    unsigned int seed = 12345;
+    while (written < size) {
+        seed = seed * 1103515245u + 12345u;
+        size_t length = (seed >> 16) % 100;
+        for (size_t i = 0; i < length; i++) {
+            line[i] = 'a' + (char)((seed >> (i % 16)) % 26);
+        }
+        line[length++] = '\n';
+        if (length > size - written) {
+            length = size - written;
+        }
+        fwrite(line, 1, length, file);
+        written += length;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+#endif
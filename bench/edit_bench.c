@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "buffer.h"
+#include "history.h"
+#include "bench.h"
+
+/* Replays edit scripts against a Buffer and History the way the input loop
+ * drives them, without a terminal. Each scenario runs in its own process so
+ * peak RSS is per scenario; allocations are counted by wrapping malloc,
+ * calloc and realloc at link time (-Wl,--wrap=...). Every scenario runs
+ * against both the gap buffer and the piece table.
+ *
+ * Recorded scripts can be passed as arguments, one command per line:
+ *   move <pos>      put the cursor at byte <pos> (clamped)
+ *   type <text>     type <text> one key at a time at the cursor
+ *   paste <text>    insert <text> as one paste at the cursor
+ *   enter           insert a newline at the cursor
+ *   backspace       delete the byte before the cursor
+ *   delete          delete the byte under the cursor
+ *   undo / redo     undo or redo one step
+ */
+
+static size_t allocations = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+typedef struct {
+    Buffer* buf;
+    History* history;
+    size_t cursor;
+    size_t ops;
+} Editor;
+
+static void type_key(Editor* ed, char ch) {
+    if (ch == '\n') {
+        start_batch(ed->history);
+        record_enter(ed->history, ed->cursor);
+        end_batch(ed->history);
+    } else {
+        record_insert(ed->history, ed->cursor, ch);
+    }
+    insert_string(ed->buf, ed->cursor, &ch, 1);
+    ed->cursor++;
+    ed->ops++;
+}
+
+static void paste(Editor* ed, const char* text, size_t length) {
+    record_insert_text(ed->history, ed->cursor, text, length);
+    insert_string(ed->buf, ed->cursor, text, length);
+    ed->cursor += length;
+    ed->ops++;
+}
+
+static void backspace(Editor* ed) {
+    if (ed->cursor > 0) {
+        record_delete(ed->history, ed->cursor - 1, buffer_char_at(ed->buf, ed->cursor - 1));
+        delete_range(ed->buf, ed->cursor - 1, 1);
+        ed->cursor--;
+    }
+    ed->ops++;
+}
+
+static void delete_forward(Editor* ed) {
+    if (ed->cursor < ed->buf->text_size) {
+        record_delete(ed->history, ed->cursor, buffer_char_at(ed->buf, ed->cursor));
+        delete_range(ed->buf, ed->cursor, 1);
+    }
+    ed->ops++;
+}
+
+static void move_cursor(Editor* ed, size_t position) {
+    ed->cursor = position < ed->buf->text_size ? position : ed->buf->text_size;
+    close_history_span(ed->history);
+    ed->ops++;
+}
+
+static void undo_step(Editor* ed) {
+    undo(ed->history, ed->buf, &ed->cursor);
+    ed->ops++;
+}
+
+static void redo_step(Editor* ed) {
+    redo(ed->history, ed->buf, &ed->cursor);
+    ed->ops++;
+}
+
+static char word_char(size_t i) {
+    if (i % 70 == 69) return '\n';
+    return i % 6 == 5 ? ' ' : 'a' + (char)(i % 26);
+}
+
+static unsigned int next_random(unsigned int* seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+/* One million keys appended to a growing document. */
+static void scenario_sequential_typing(Editor* ed) {
+    for (size_t i = 0; i < 1000000; i++) {
+        type_key(ed, word_char(i));
+    }
+}
+
+/* A 1 MB document edited at 20k random places, ten keys at each. */
+static void scenario_random_edits(Editor* ed) {
+    static char text[1024 * 1024];
+    for (size_t i = 0; i < sizeof(text); i++) {
+        text[i] = word_char(i);
+    }
+    insert_string(ed->buf, 0, text, sizeof(text));
+
+    unsigned int seed = 42;
+    for (size_t site = 0; site < 20000; site++) {
+        move_cursor(ed, next_random(&seed) % (ed->buf->text_size + 1));
+        for (size_t i = 0; i < 10; i++) {
+            if (i % 4 == 3) {
+                backspace(ed);
+            } else {
+                type_key(ed, word_char(i));
+            }
+        }
+    }
+}
+
+/* 2000 pastes of 4 KB at random places. */
+static void scenario_paste_bursts(Editor* ed) {
+    static char chunk[4096];
+    for (size_t i = 0; i < sizeof(chunk); i++) {
+        chunk[i] = word_char(i);
+    }
+
+    unsigned int seed = 7;
+    for (size_t i = 0; i < 2000; i++) {
+        move_cursor(ed, next_random(&seed) % (ed->buf->text_size + 1));
+        paste(ed, chunk, sizeof(chunk));
+    }
+}
+
+/* 200k keys typed, then everything undone and redone three times. */
+static void scenario_undo_storm(Editor* ed) {
+    for (size_t i = 0; i < 200000; i++) {
+        type_key(ed, word_char(i));
+        if (i % 500 == 499) {
+            delete_forward(ed);
+            backspace(ed);
+        }
+    }
+
+    for (int round = 0; round < 3; round++) {
+        while (ed->history->current) {
+            undo_step(ed);
+        }
+        while (ed->history->current != ed->history->tail) {
+            redo_step(ed);
+        }
+    }
+}
+
+static char* script_text = NULL;
+
+static void scenario_script(Editor* ed) {
+    char* line = script_text;
+    while (line && *line) {
+        char* end = strchr(line, '\n');
+        if (end) *end = '\0';
+
+        if (strncmp(line, "type ", 5) == 0) {
+            for (const char* p = line + 5; *p; p++) type_key(ed, *p);
+        } else if (strncmp(line, "paste ", 6) == 0) {
+            paste(ed, line + 6, strlen(line + 6));
+        } else if (strncmp(line, "move ", 5) == 0) {
+            move_cursor(ed, strtoull(line + 5, NULL, 10));
+        } else if (strcmp(line, "enter") == 0) {
+            type_key(ed, '\n');
+        } else if (strcmp(line, "backspace") == 0) {
+            backspace(ed);
+        } else if (strcmp(line, "delete") == 0) {
+            delete_forward(ed);
+        } else if (strcmp(line, "undo") == 0) {
+            undo_step(ed);
+        } else if (strcmp(line, "redo") == 0) {
+            redo_step(ed);
+        }
+
+        line = end ? end + 1 : NULL;
+    }
+}
+
+static void run_scenario(const char* name, void (*scenario)(Editor*), int pieces) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return;
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    Buffer* buf = pieces ? create_piece_buffer() : create_buffer();
+    Editor ed = {buf, create_history(HISTORY_DEFAULT_MB * 1024 * 1024), 0, 0};
+
+    allocations = 0;
+    uint64_t start = bench_now_ns();
+    scenario(&ed);
+    uint64_t elapsed = bench_now_ns() - start;
+    size_t counted = allocations;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"bench\":\"edit\",\"scenario\":\"%s\",\"backend\":\"%s\",\"ops\":%zu,\"ns\":%llu,\"ns_per_op\":%.1f,"
+           "\"allocs\":%zu,\"peak_rss_kb\":%ld,\"text_bytes\":%zu}\n",
+           name, pieces ? "pieces" : "gap", ed.ops, (unsigned long long)elapsed, ed.ops ? (double)elapsed / ed.ops : 0.0,
+           counted, usage.ru_maxrss, ed.buf->text_size);
+    fflush(stdout);
+    _exit(0);
+}
+
+static char* read_script(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        perror("Error opening script");
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char* text = (char*)malloc((size_t)size + 1);
+    if (text) {
+        text[fread(text, 1, (size_t)size, file)] = '\0';
+    }
+    fclose(file);
+    return text;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            script_text = read_script(argv[i]);
+            if (script_text) {
+                char name[256];
+                snprintf(name, sizeof(name), "script:%s", argv[i]);
+                run_scenario(name, scenario_script, 0);
+                run_scenario(name, scenario_script, 1);
+                free(script_text);
+            }
+        }
+        return 0;
+    }
+
+    for (int pieces = 0; pieces <= 1; pieces++) {
+        run_scenario("sequential_typing_1m", scenario_sequential_typing, pieces);
+        run_scenario("random_edits_20k_sites", scenario_random_edits, pieces);
+        run_scenario("paste_bursts_2000x4k", scenario_paste_bursts, pieces);
+        run_scenario("undo_storm_200k", scenario_undo_storm, pieces);
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "history.h"
+#include "bench.h"
+
+#define EDITS 1000000
+
+/* Five-letter words separated by spaces, so span coalescing sees word
+ * boundaries the way it would with real typing. */
+static char typed_char(size_t i) {
+    return i % 6 == 5 ? ' ' : 'a' + (char)(i % 26);
+}
+
+/* Typing with a 64 KB history budget: once full, every new word evicts
+ * the oldest one. */
+static uint64_t bench_budgeted_typing(void) {
+    Buffer* buf = create_buffer();
+    History* history = create_history(64 * 1024);
+
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < EDITS; i++) {
+        char ch = typed_char(i);
+        record_insert(history, buffer_cursor(buf), ch);
+        insert_buffer(buf, ch);
+    }
+    free_history(history);
+    uint64_t elapsed = bench_now_ns() - start;
+
+    free_buffer(buf);
+    return elapsed;
+}
+
+/* Unbounded history that is built up and torn down in one go. */
+static uint64_t bench_unbounded_typing(void) {
+    Buffer* buf = create_buffer();
+    History* history = create_history(0);
+
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < EDITS; i++) {
+        char ch = typed_char(i);
+        record_insert(history, buffer_cursor(buf), ch);
+        insert_buffer(buf, ch);
+    }
+    free_history(history);
+    uint64_t elapsed = bench_now_ns() - start;
+
+    free_buffer(buf);
+    return elapsed;
+}
+
+/* Type 64 keys, undo 32, repeat: every record after an undo drops a redo
+ * branch of 32 nodes. */
+static uint64_t bench_undo_churn(void) {
+    Buffer* buf = create_buffer();
+    History* history = create_history(0);
+    size_t position = 0;
+
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < EDITS; i++) {
+        if (i % 64 >= 32 && i % 64 < 48) {
+            undo(history, buf, &position);
+            undo(history, buf, &position);
+            continue;
+        }
+        char ch = typed_char(i);
+        move_buffer_cursor(buf, position);
+        record_insert(history, position, ch);
+        insert_buffer(buf, ch);
+        position++;
+    }
+    free_history(history);
+    uint64_t elapsed = bench_now_ns() - start;
+
+    free_buffer(buf);
+    return elapsed;
+}
+
+/* Replace-all style transactions: each batch swaps every tenth byte of a
+ * 5000-byte line, and is then undone and redone as one step. */
+static uint64_t bench_batch_replace(void) {
+    Buffer* buf = create_buffer();
+    History* history = create_history(0);
+    size_t position = 0;
+
+    for (size_t i = 0; i < 5000; i++) {
+        insert_buffer(buf, typed_char(i));
+    }
+
+    uint64_t start = bench_now_ns();
+    for (size_t batch = 0; batch < EDITS / 1000; batch++) {
+        start_batch(history);
+        for (size_t at = 0; at < 5000; at += 10) {
+            record_delete(history, at, buffer_char_at(buf, at));
+            delete_range(buf, at, 1);
+            record_insert(history, at, 'X');
+            insert_string(buf, at, "X", 1);
+        }
+        end_batch(history);
+        undo(history, buf, &position);
+        redo(history, buf, &position);
+    }
+    free_history(history);
+    uint64_t elapsed = bench_now_ns() - start;
+
+    free_buffer(buf);
+    return elapsed;
+}
+
+/* The step count shown by Ctrl+G must follow the steps kept, with or
+ * without a budget. */
+static int check_step_count(size_t max_bytes) {
+    Buffer* buf = create_buffer();
+    History* history = create_history(max_bytes);
+    for (size_t i = 0; i < 10000; i++) {
+        char ch = typed_char(i);
+        record_insert(history, buffer_cursor(buf), ch);
+        insert_buffer(buf, ch);
+    }
+
+    int steps = 0;
+    for (HistoryNode* node = history->head; node; node = node == history->tail ? NULL : node->next) {
+        steps++;
+    }
+    int count = history->count;
+    free_history(history);
+    free_buffer(buf);
+
+    if (steps == 0 || count != steps) {
+        fprintf(stderr, "step count with budget %zu: %d, kept %d\n", max_bytes, count, steps);
+        return -1;
+    }
+    return 0;
+}
+
+/* Dropping redo branches puts their span text on the free list; what is
+ * kept there must stay inside the budget with the live steps and match
+ * what the free list really holds. */
+static int check_spare_budget(void) {
+    static const size_t budget = 256 * 1024;
+    char chunk[3000];
+    memset(chunk, 'x', sizeof(chunk));
+
+    Buffer* buf = create_buffer();
+    History* history = create_history(budget);
+    size_t position = 0;
+    int failed = 0;
+    for (int round = 0; round < 20 && !failed; round++) {
+        for (int i = 0; i < 100; i++) {
+            record_insert_text(history, buf->text_size, chunk, sizeof(chunk));
+            insert_string(buf, buf->text_size, chunk, sizeof(chunk));
+        }
+        for (int i = 0; i < 90; i++) {
+            undo(history, buf, &position);
+        }
+
+        size_t kept = 0;
+        for (HistoryNode* node = history->free_nodes; node; node = node->next) {
+            kept += node->capacity;
+        }
+        if (history->bytes + history->spare_bytes > budget || kept != history->spare_bytes) {
+            fprintf(stderr, "spare text: live %zu + spare %zu over %zu, free list holds %zu\n",
+                    history->bytes, history->spare_bytes, budget, kept);
+            failed = 1;
+        }
+    }
+    free_history(history);
+    free_buffer(buf);
+    return failed ? -1 : 0;
+}
+
+static void report(const char* scenario, uint64_t elapsed) {
+    printf("{\"bench\":\"history\",\"scenario\":\"%s\",\"ops\":%d,\"ns\":%llu,\"ns_per_op\":%.1f}\n",
+           scenario, EDITS, (unsigned long long)elapsed, (double)elapsed / EDITS);
+}
+
+int main(void) {
+    report("record_1m_budget64k", bench_budgeted_typing());
+    report("record_1m_unbounded", bench_unbounded_typing());
+    report("undo_redo_branch_churn", bench_undo_churn());
+    report("batch_replace_undo_redo", bench_batch_replace());
+
+    int failed = check_step_count(0) < 0;
+    failed |= check_step_count(4096) < 0;
+    failed |= check_spare_budget() < 0;
+    return failed;
+}
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "buffer.h"
+#include "journal.h"
+#include "bench.h"
+
+#define FILE_MB 100
+#define EDITS 10000
+#define EDIT_SITES 20
+
+/* Journals EDITS keystrokes spread over EDIT_SITES places in the file:
+ * mostly typing, with a Backspace every eighth key. */
+static void write_edit_journal(const char* path, size_t file_size) {
+    Journal* journal = open_journal(lock_journal(path), path, 0);
+    if (!journal) {
+        exit(1);
+    }
+
+    size_t text_size = file_size;
+    unsigned int seed = 777;
+    for (size_t site = 0; site < EDIT_SITES; site++) {
+        seed = seed * 1103515245u + 12345u;
+        size_t position = (size_t)(((unsigned long long)seed << 16) % text_size);
+
+        for (size_t i = 0; i < EDITS / EDIT_SITES; i++) {
+            if (i % 8 == 7 && position > 0) {
+                journal_delete(journal, position - 1, 1);
+                position--;
+                text_size--;
+            } else {
+                char ch = i % 6 == 5 ? ' ' : 'a' + (char)(i % 26);
+                journal_insert(journal, position, &ch, 1);
+                position++;
+                text_size++;
+            }
+        }
+    }
+
+    close_journal(journal, 0);
+}
+
+/* Opens path with its journal locked and replayed, the way the editor
+ * does; the locked descriptor is left in *fd. */
+static Buffer* recover(const char* path, JournalRecovery* recovery, int* fd) {
+    Buffer* buf = create_buffer();
+    load_file_into_buffer((char*)path, buf);
+    *fd = lock_journal(path);
+    if (*fd >= 0) {
+        replay_journal(*fd, path, buf, recovery);
+    }
+    return buf;
+}
+
+static void journal_file_of(const char* path, char* out, size_t size) {
+    const char* slash = strrchr(path, '/');
+    snprintf(out, size, "%.*s.%s.journal", (int)(slash - path + 1), path, slash + 1);
+}
+
+/* A crash mid-record leaves a torn tail. Edits made after recovering from
+ * it must still be found by the next recovery. */
+static int check_torn_record(const char* path) {
+    Journal* journal = open_journal(lock_journal(path), path, 0);
+    if (!journal) return -1;
+    journal_insert(journal, 0, "abc", 3);
+    close_journal(journal, 0);
+
+    char journal_file[4096];
+    journal_file_of(path, journal_file, sizeof(journal_file));
+    int fd = open(journal_file, O_WRONLY | O_APPEND);
+    if (fd < 0 || write(fd, "I\x01\x02\x03\x04", 5) != 5) {
+        perror("Failed to tear journal");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    close(fd);
+
+    JournalRecovery recovery;
+    Buffer* buf = recover(path, &recovery, &fd);
+    free_buffer(buf);
+    journal = open_journal(fd, path, recovery.replayed > 0 ? recovery.end : 0);
+    if (!journal) return -1;
+    journal_insert(journal, 3, "xyz", 3);
+    close_journal(journal, 0);
+
+    char head[6];
+    buf = recover(path, &recovery, &fd);
+    size_t length = read_range(buf, 0, sizeof(head), head);
+    free_buffer(buf);
+    close(fd);
+    if (recovery.replayed != 2 || length != sizeof(head) || memcmp(head, "abcxyz", sizeof(head)) != 0) {
+        fprintf(stderr, "torn record: replayed %zu edits, text starts \"%.*s\"\n", recovery.replayed, (int)length, head);
+        return -1;
+    }
+    return 0;
+}
+
+/* A second editor on the same file must not replay or write the first
+ * one's live journal. */
+static int check_journal_lock(const char* path) {
+    Journal* journal = open_journal(lock_journal(path), path, 0);
+    if (!journal) return -1;
+    journal_insert(journal, 0, "abc", 3);
+
+    int second = lock_journal(path);
+    close_journal(journal, 1);
+    if (second != JOURNAL_BUSY) {
+        fprintf(stderr, "journal lock: second editor got %d\n", second);
+        if (second >= 0) close(second);
+        return -1;
+    }
+    return 0;
+}
+
+/* A journal left against an older version of the file is kept aside,
+ * not emptied. */
+static int check_stale_journal(const char* path) {
+    Journal* journal = open_journal(lock_journal(path), path, 0);
+    if (!journal) return -1;
+    journal_insert(journal, 0, "abc", 3);
+    close_journal(journal, 0);
+
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1, 0}};
+    utimensat(AT_FDCWD, path, times, 0);
+
+    JournalRecovery recovery;
+    int fd;
+    Buffer* buf = recover(path, &recovery, &fd);
+    free_buffer(buf);
+    journal = open_journal(fd, path, 0);
+    close_journal(journal, 1);
+
+    struct stat st;
+    int kept = recovery.stale == 1 && stat(recovery.stale_path, &st) == 0 && st.st_size > 0;
+    if (recovery.stale == 1) {
+        unlink(recovery.stale_path);
+    }
+    if (recovery.replayed != 0 || !kept) {
+        fprintf(stderr, "stale journal: replayed %zu, stale %d\n", recovery.replayed, recovery.stale);
+        return -1;
+    }
+    return 0;
+}
+
+/* Only edits the buffer has made reach the journal: ones a view refuses,
+ * or that fall past the end of the text, must not come back on recovery. */
+static int check_refused_edits(const char* path) {
+    Journal* journal = open_journal(lock_journal(path), path, 0);
+    if (!journal) return -1;
+
+    Buffer* view = create_view_buffer();
+    load_file_into_buffer((char*)path, view);
+    view->edit_observer = journal_edit;
+    view->edit_context = journal;
+    insert_string(view, 0, "abc", 3);
+    delete_range(view, 0, 3);
+    free_buffer(view);
+
+    Buffer* buf = create_buffer();
+    load_file_into_buffer((char*)path, buf);
+    buf->edit_observer = journal_edit;
+    buf->edit_context = journal;
+    insert_string(buf, 0, "xyz", 3);
+    insert_string(buf, buf->text_size + 1, "abc", 3);
+    delete_range(buf, 1, 1);
+    char expected[8];
+    size_t expected_length = read_range(buf, 0, sizeof(expected), expected);
+    free_buffer(buf);
+    close_journal(journal, 0);
+
+    JournalRecovery recovery;
+    int fd;
+    buf = recover(path, &recovery, &fd);
+    char head[8];
+    size_t length = read_range(buf, 0, sizeof(head), head);
+    free_buffer(buf);
+    journal = open_journal(fd, path, 0);
+    close_journal(journal, 1);
+
+    if (recovery.replayed != 2 || length != expected_length || memcmp(head, expected, length) != 0) {
+        fprintf(stderr, "refused edits: replayed %zu, text starts \"%.*s\"\n", recovery.replayed, (int)length, head);
+        return -1;
+    }
+    return 0;
+}
+
+int main(void) {
+    size_t size = (size_t)FILE_MB * 1024 * 1024;
+    char path[] = "/tmp/textura-journal-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    if (bench_write_sample_file(path, size) < 0) {
+        unlink(path);
+        return 1;
+    }
+    write_edit_journal(path, size);
+
+    JournalRecovery recovery;
+    uint64_t start = bench_now_ns();
+    Buffer* buf = recover(path, &recovery, &fd);
+    uint64_t elapsed = bench_now_ns() - start;
+    size_t replayed = recovery.replayed;
+    close(fd);
+
+    char scenario[64];
+    snprintf(scenario, sizeof(scenario), "recover_%dmb_%dk_edits_%zu_records", FILE_MB, EDITS / 1000, replayed);
+    bench_report("journal", scenario, size, elapsed);
+
+    free_buffer(buf);
+
+    int failed = check_torn_record(path) < 0;
+    failed |= check_journal_lock(path) < 0;
+    failed |= check_stale_journal(path) < 0;
+    failed |= check_refused_edits(path) < 0;
+
+    Journal* journal = open_journal(lock_journal(path), path, 0);
+    close_journal(journal, 1);
+    unlink(path);
+    return failed;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "buffer.h"
+#include "indexer.h"
+#include "bench.h"
+
+#define SCREEN_LINES 50
+
+/* Polls the way the input loop does until the background index is in. */
+static void wait_for_index(Buffer* buf) {
+    while (buffer_index_pending(buf) && !buffer_poll_index(buf)) {
+        usleep(100);
+    }
+}
+
+int main(int argc, char** argv) {
+    static const size_t default_sizes_mb[] = {1, 100, 1024};
+    size_t count = argc > 1 ? (size_t)(argc - 1) : sizeof(default_sizes_mb) / sizeof(default_sizes_mb[0]);
+
+    for (size_t i = 0; i < count; i++) {
+        size_t size_mb = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : default_sizes_mb[i];
+        size_t size = size_mb * 1024 * 1024;
+
+        char path[] = "/tmp/textura-load-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+
+        if (bench_write_sample_file(path, size) < 0) {
+            unlink(path);
+            return 1;
+        }
+
+        Buffer* buf = create_buffer();
+        uint64_t start = bench_now_ns();
+        load_file_into_buffer(path, buf);
+        uint64_t elapsed = bench_now_ns() - start;
+
+        char scenario[32];
+        snprintf(scenario, sizeof(scenario), "load_%zumb", size_mb);
+        bench_report("load", scenario, size, elapsed);
+
+        /* Line index of the loaded text by worker count, to show scaling. */
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        for (size_t threads = 1; threads <= (size_t)(cores > 0 ? cores : 1); threads *= 2) {
+            index_use_threads(threads);
+            size_t newlines;
+            start = bench_now_ns();
+            free(index_newlines(buf->buffer, buf->gap_start, 1, 1, &newlines, NULL, NULL));
+            elapsed = bench_now_ns() - start;
+
+            snprintf(scenario, sizeof(scenario), "index_%zumb_%zut", size_mb, threads);
+            bench_report("load", scenario, size, elapsed);
+        }
+        index_use_threads(0);
+
+        free_buffer(buf);
+
+        /* Piece table: opening maps the file and starts the background
+         * index; the first screen comes from the sparse scan meanwhile. */
+        buf = create_piece_buffer();
+        start = bench_now_ns();
+        load_file_into_buffer(path, buf);
+        elapsed = bench_now_ns() - start;
+
+        snprintf(scenario, sizeof(scenario), "open_pieces_%zumb", size_mb);
+        bench_report("load", scenario, size, elapsed);
+
+        start = bench_now_ns();
+        buffer_line_start(buf, SCREEN_LINES);
+        elapsed = bench_now_ns() - start;
+
+        snprintf(scenario, sizeof(scenario), "first_screen_pieces_%zumb", size_mb);
+        bench_report("load", scenario, size, elapsed);
+
+        start = bench_now_ns();
+        wait_for_index(buf);
+        elapsed = bench_now_ns() - start;
+
+        snprintf(scenario, sizeof(scenario), "index_pieces_%zumb", size_mb);
+        bench_report("load", scenario, size, elapsed);
+
+        free_buffer(buf);
+
+        /* Read-only view: open plus the first screen of lines, then the
+         * sparse index of the rest. */
+        buf = create_view_buffer();
+        start = bench_now_ns();
+        load_file_into_buffer(path, buf);
+        buffer_line_count(buf);
+        elapsed = bench_now_ns() - start;
+
+        snprintf(scenario, sizeof(scenario), "open_view_%zumb", size_mb);
+        bench_report("load", scenario, size, elapsed);
+
+        start = bench_now_ns();
+        wait_for_index(buf);
+        elapsed = bench_now_ns() - start;
+
+        snprintf(scenario, sizeof(scenario), "index_view_%zumb", size_mb);
+        bench_report("load", scenario, size, elapsed);
+
+        free_buffer(buf);
+        unlink(path);
+    }
+
+    return 0;
+}
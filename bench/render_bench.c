@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ncurses.h>
+#include "buffer.h"
+#include "utils.h"
+#include "render.h"
+#include "bench.h"
+
+#define FRAMES 200
+
+/* The pre-batching renderer: one attron/mvaddch/attroff per visible cell. */
+static void redraw_per_cell(Buffer* buf, size_t width, size_t rows) {
+    size_t text_cols = TEXT_AREA_WIDTH(buf, width);
+    for (size_t y = 0; y < rows; y++) {
+        size_t line = buf->first_line + y;
+        move(y, 0);
+        clrtoeol();
+        if (line >= buffer_line_count(buf)) continue;
+        display_line_number(buf, line, y);
+
+        size_t start = buffer_line_start(buf, line);
+        size_t length = buffer_line_length(buf, line);
+        for (size_t column = 0; column < length && column < text_cols; column++) {
+            attron(COLOR_PAIR(1));
+            mvaddch(y, column + 1 + line_number_width(buf), buffer_char_at(buf, start + column));
+            attroff(COLOR_PAIR(1));
+        }
+    }
+    refresh();
+}
+
+static Buffer* sample_buffer(size_t lines, size_t line_length) {
+    Buffer* buf = create_buffer();
+    char* line = malloc(line_length + 1);
+    for (size_t i = 0; i < line_length; i++) {
+        line[i] = 'a' + (char)(i % 26);
+    }
+    line[line_length] = '\n';
+    for (size_t i = 0; i < lines; i++) {
+        line[i % line_length] = '#';
+        insert_buffer_n(buf, line, line_length + 1);
+        line[i % line_length] = 'a' + (char)((i % line_length) % 26);
+    }
+    free(line);
+    /* Put the gap mid-screen so rows straddle it. */
+    move_buffer_cursor(buf, buffer_line_start(buf, 40) + line_length / 2);
+    return buf;
+}
+
+static void report_frames(const char* scenario, Framebuffer* frame, size_t operations, uint64_t elapsed_ns) {
+    printf("{\"bench\":\"render\",\"scenario\":\"%s\",\"ops\":%zu,\"ns\":%llu,\"ns_per_op\":%.1f,"
+           "\"frames\":%zu,\"cells\":%zu,\"cells_per_op\":%.1f,\"rows_cleared\":%zu}\n",
+           scenario, operations, (unsigned long long)elapsed_ns, (double)elapsed_ns / operations,
+           frame->frames, frame->cells_written, (double)frame->cells_written / operations, frame->rows_cleared);
+    fflush(stdout);
+}
+
+/* The same redraw, typing and status bar paths drawn into a headless
+ * framebuffer, so only the editor's own work is timed. */
+static void bench_framebuffer(Buffer* buf, int rows, int cols) {
+    Framebuffer* frame = create_framebuffer(rows, cols);
+    if (!frame) return;
+    set_render_backend(&frame->base);
+
+    size_t width = (size_t)cols;
+    invalidate_window();
+    uint64_t start = bench_now_ns();
+    for (size_t frame_index = 0; frame_index < FRAMES; frame_index++) {
+        buf->first_line = frame_index;
+        redraw_window(buf, width);
+    }
+    report_frames("framebuffer_scroll_300x100", frame, FRAMES, bench_now_ns() - start);
+
+    /* Typing mid-screen repaints only the damaged row. */
+    buf->first_line = 0;
+    redraw_window(buf, width);
+    size_t x_pos = 1 + LINE_NUMBER_WIDTH + 10, y_pos = 40;
+    reset_framebuffer_counters(frame);
+    start = bench_now_ns();
+    for (size_t i = 0; i < 10000; i++) {
+        update_general_window(buf, &x_pos, &y_pos, 'a' + (int)(i % 26), width);
+        if (x_pos >= width - 1) {
+            x_pos = 1 + LINE_NUMBER_WIDTH;
+        }
+    }
+    report_frames("framebuffer_typing_10k", frame, 10000, bench_now_ns() - start);
+
+    reset_framebuffer_counters(frame);
+    start = bench_now_ns();
+    for (size_t i = 0; i < 10000; i++) {
+        display_status_bar(buf, "/tmp/sample.txt", x_pos, y_pos);
+    }
+    report_frames("framebuffer_status_bar_10k", frame, 10000, bench_now_ns() - start);
+
+    set_render_backend(NULL);
+    free_framebuffer(frame);
+}
+
+/* Go-to-line and paging through a two-million-line buffer: each jump
+ * should cost one screen of cells wherever it lands. */
+static void bench_navigation(int rows, int cols) {
+    static const size_t lines = 2000000;
+    static const size_t jumps = 10000;
+
+    Framebuffer* frame = create_framebuffer(rows, cols);
+    if (!frame) return;
+    set_render_backend(&frame->base);
+
+    Buffer* buf = create_buffer();
+    char line[32];
+    for (size_t i = 0; i < lines; i++) {
+        int length = snprintf(line, sizeof(line), "line %zu of the sample\n", i + 1);
+        insert_buffer_n(buf, line, (size_t)length);
+    }
+
+    size_t width = (size_t)cols;
+    size_t x_pos = 1 + LINE_NUMBER_WIDTH, y_pos = 0;
+    invalidate_window();
+    redraw_window(buf, width);
+
+    unsigned int seed = 12345;
+    reset_framebuffer_counters(frame);
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < jumps; i++) {
+        seed = seed * 1103515245u + 12345u;
+        size_t target = buffer_position_of(buf, (seed >> 8) % lines, 0);
+        jump_to_position(buf, target, &x_pos, &y_pos, width);
+    }
+    report_frames("framebuffer_goto_line_10k", frame, jumps, bench_now_ns() - start);
+
+    jump_to_position(buf, 0, &x_pos, &y_pos, width);
+    reset_framebuffer_counters(frame);
+    start = bench_now_ns();
+    for (size_t i = 0; i < jumps; i++) {
+        scroll_page(buf, 1, &x_pos, &y_pos, width);
+    }
+    report_frames("framebuffer_page_down_10k", frame, jumps, bench_now_ns() - start);
+
+    /* Every row on screen holds a match, so this is the worst case for
+     * drawing the search highlight. */
+    SearchPattern pattern;
+    compile_search_pattern(&pattern, "sample", 6);
+    set_search_highlight(&pattern);
+    jump_to_position(buf, 0, &x_pos, &y_pos, width);
+    reset_framebuffer_counters(frame);
+    start = bench_now_ns();
+    for (size_t i = 0; i < jumps; i++) {
+        scroll_page(buf, 1, &x_pos, &y_pos, width);
+    }
+    report_frames("framebuffer_page_down_highlight_10k", frame, jumps, bench_now_ns() - start);
+    set_search_highlight(NULL);
+
+    set_render_backend(NULL);
+    free_framebuffer(frame);
+    free_buffer(buf);
+}
+
+int main(void) {
+    setenv("LINES", "100", 1);
+    setenv("COLUMNS", "300", 1);
+    FILE* sink = fopen("/dev/null", "w");
+    SCREEN* screen = newterm("xterm", sink, stdin);
+    if (!screen) {
+        fprintf(stderr, "Failed to create headless terminal\n");
+        return 1;
+    }
+
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    size_t width = (size_t)cols;
+    size_t text_rows = TEXT_AREA_HEIGHT((size_t)rows);
+    Buffer* buf = sample_buffer(FRAMES + text_rows, width);
+
+    /* Scroll one line per frame so every row changes and refresh has work. */
+    uint64_t start = bench_now_ns();
+    for (size_t frame = 0; frame < FRAMES; frame++) {
+        buf->first_line = frame;
+        redraw_per_cell(buf, width, text_rows);
+    }
+    uint64_t per_cell = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (size_t frame = 0; frame < FRAMES; frame++) {
+        buf->first_line = frame;
+        redraw_window(buf, width);
+    }
+    uint64_t batched = bench_now_ns() - start;
+
+    endwin();
+    delscreen(screen);
+    fclose(sink);
+
+    size_t cells = (size_t)FRAMES * text_rows * (width - LINE_NUMBER_WIDTH - 1);
+    bench_report("render", "per_cell_300x100", cells, per_cell);
+    bench_report("render", "row_batched_300x100", cells, batched);
+    printf("{\"bench\":\"render\",\"scenario\":\"frame_us\",\"per_cell\":%.1f,\"row_batched\":%.1f}\n",
+           per_cell / 1000.0 / FRAMES, batched / 1000.0 / FRAMES);
+
+    bench_framebuffer(buf, rows, cols);
+    bench_navigation(rows, cols);
+
+    free_buffer(buf);
+    return 0;
+}
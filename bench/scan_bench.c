@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scan.h"
+#include "bench.h"
+
+#define SAMPLE_SIZE (64u * 1024u * 1024u)
+#define ROUNDS 5
+
+static void fill_sample(char* text, size_t size) {
+    static const char separators[] = "  \n\t";
+    unsigned int seed = 42;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245u + 12345u;
+        unsigned int r = (seed >> 16) & 0xFF;
+        text[i] = r < 40 ? separators[r & 3] : (char)('a' + r % 26);
+    }
+}
+
+typedef size_t (*Kernel)(const char* text, size_t length, size_t* scratch);
+
+static size_t run_newlines(const char* text, size_t length, size_t* scratch) {
+    (void)scratch;
+    return scan_count_newlines(text, length);
+}
+
+static size_t run_non_blank(const char* text, size_t length, size_t* scratch) {
+    (void)scratch;
+    return scan_count_non_blank(text, length);
+}
+
+static size_t run_word_starts(const char* text, size_t length, size_t* scratch) {
+    (void)scratch;
+    return scan_count_word_starts(text, length, 0);
+}
+
+static size_t run_line_starts(const char* text, size_t length, size_t* scratch) {
+    return scan_newline_positions(text, length, 1, scratch);
+}
+
+int main(void) {
+    static const struct { const char* name; Kernel kernel; } kernels[] = {
+        {"count_newlines", run_newlines},
+        {"count_non_blank", run_non_blank},
+        {"count_word_starts", run_word_starts},
+        {"newline_positions", run_line_starts},
+    };
+    static const ScanLevel levels[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+
+    char* text = malloc(SAMPLE_SIZE);
+    size_t* scratch = malloc(sizeof(size_t) * (SAMPLE_SIZE / 8 + 1));
+    if (!text || !scratch) {
+        perror("Failed to allocate benchmark buffers");
+        return 1;
+    }
+    fill_sample(text, SAMPLE_SIZE);
+
+    int failed = 0;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        size_t expected = 0;
+        for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+            ScanLevel level = scan_use_level(levels[l]);
+            if (level != levels[l]) continue;
+
+            /* Odd offset and length so unaligned heads and scalar tails run too. */
+            size_t result = 0;
+            uint64_t best = UINT64_MAX;
+            for (int round = 0; round < ROUNDS; round++) {
+                uint64_t start = bench_now_ns();
+                result = kernels[k].kernel(text + 1, SAMPLE_SIZE - 3, scratch);
+                uint64_t elapsed = bench_now_ns() - start;
+                if (elapsed < best) best = elapsed;
+            }
+
+            if (level == SCAN_SCALAR) {
+                expected = result;
+            } else if (result != expected) {
+                fprintf(stderr, "%s/%s: got %zu, scalar %zu\n",
+                        kernels[k].name, scan_level_name(level), result, expected);
+                failed = 1;
+            }
+
+            char scenario[64];
+            snprintf(scenario, sizeof(scenario), "%s/%s", kernels[k].name, scan_level_name(level));
+            bench_report("scan", scenario, SAMPLE_SIZE - 3, best);
+        }
+    }
+
+    free(scratch);
+    free(text);
+    return failed;
+}
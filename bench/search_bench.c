@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "buffer.h"
+#include "search.h"
+#include "bench.h"
+
+#define SAMPLE_SIZE (128u * 1024u * 1024u)
+#define PIECE_EDITS 1000
+#define ROUNDS 3
+
+static void wait_for_index(Buffer* buf) {
+    while (buffer_index_pending(buf) && !buffer_poll_index(buf)) {
+        usleep(100);
+    }
+}
+
+/* Times a search over the whole buffer; the patterns never occur in the
+ * sample, so every byte is looked at. */
+static void run_search(Buffer* buf, const char* backend, const char* name, const char* text, int direction) {
+    SearchPattern pattern;
+    compile_search_pattern(&pattern, text, strlen(text));
+
+    uint64_t best = UINT64_MAX;
+    size_t scanned = buf->text_size;
+    for (int round = 0; round < ROUNDS; round++) {
+        size_t match;
+        uint64_t start = bench_now_ns();
+        int found = direction > 0 ? search_forward(buf, &pattern, 0, &match)
+                                  : search_backward(buf, &pattern, buf->text_size, &match);
+        uint64_t elapsed = bench_now_ns() - start;
+        if (elapsed < best) best = elapsed;
+        if (found) {
+            scanned = direction > 0 ? match : buf->text_size - match;
+        }
+    }
+
+    char scenario[64];
+    snprintf(scenario, sizeof(scenario), "%s_%s_%s", direction > 0 ? "forward" : "backward", name, backend);
+    bench_report("search", scenario, scanned, best);
+}
+
+static void run_searches(Buffer* buf, const char* backend) {
+    /* A first byte that never occurs leaves it all to memchr; a common one
+     * exercises the Horspool skips. */
+    run_search(buf, backend, "rare", "Textura", 1);
+    run_search(buf, backend, "rare", "Textura", -1);
+    run_search(buf, backend, "word", "quixotic", 1);
+    run_search(buf, backend, "word", "quixotic", -1);
+    run_search(buf, backend, "short", "zq", 1);
+}
+
+int main(void) {
+    char path[] = "/tmp/textura-search-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    if (bench_write_sample_file(path, SAMPLE_SIZE) < 0) {
+        unlink(path);
+        return 1;
+    }
+
+    /* Gap buffer with the gap in the middle of the text. */
+    Buffer* buf = create_buffer();
+    load_file_into_buffer(path, buf);
+    insert_string(buf, buf->text_size / 2, "\n", 1);
+    run_searches(buf, "gap");
+    free_buffer(buf);
+
+    /* Piece table split into a couple of thousand pieces by small edits. */
+    buf = create_piece_buffer();
+    load_file_into_buffer(path, buf);
+    wait_for_index(buf);
+    unsigned int seed = 7;
+    for (int i = 0; i < PIECE_EDITS; i++) {
+        seed = seed * 1103515245u + 12345u;
+        insert_string(buf, (seed >> 4) % buf->text_size, "\n", 1);
+    }
+    run_searches(buf, "pieces");
+    free_buffer(buf);
+
+    unlink(path);
+    return 0;
+}
@@ -1,10 +1,40 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/uio.h>
 
 #pragma once
 
 #define INITIAL_BUFFER_SIZE 1024  
-#define GAP_SIZE 5
+#define GAP_SIZE 64
+#define GAP_GROWTH_DIVISOR 2
+#define DAMAGE_TO_END ((size_t)-1)
+
+/* Saves write at most this much per call so progress can be reported. */
+#define SAVE_CHUNK_BYTES (8 * 1024 * 1024)
+
+struct PieceTable;
+
+typedef void (*save_progress_fn)(void* context, size_t written, size_t total);
+
+/* Told about every edit the buffer has actually made: an insert of text at
+ * position, or a delete of length bytes there when text is NULL. */
+typedef void (*edit_observer_fn)(void* context, size_t position, const char* text, size_t length);
+
+/* Lets a save write a gap buffer straight from its array: called once,
+ * before the buffer first changes or moves any byte the save still reads
+ * in place, so the save can take its own copy. */
+typedef void (*unshare_fn)(void* context);
+
+/* Line start offsets kept as a gap array mirroring the text gap: entries
+ * [0, gap_start) are absolute offsets at or before the text gap, entries
+ * [gap_end, capacity) store (text_size - offset) for lines starting after
+ * it, so typing at the gap never has to touch the rest of the index. */
+typedef struct {
+    size_t* starts;
+    size_t capacity;
+    size_t gap_start;
+    size_t gap_end;
+} LineIndex;
 
 typedef struct {
     char* buffer;
@@ -14,16 +44,65 @@ typedef struct {
     size_t text_size;
     size_t last_character;
     size_t first_character;
+    size_t first_line;
+    size_t first_column;
+    LineIndex lines;
+    size_t word_count;
+    size_t non_space_count;
+    size_t damage_start;
+    size_t damage_end;
+    size_t generation;          /* bumped by every edit */
+    size_t saved_generation;    /* generation last loaded or saved */
+    struct PieceTable* pieces;  /* set when the text lives in a piece table
+                                   instead of the gap fields above */
+    int read_only;              /* a view: edits are refused and lines are
+                                   indexed lazily */
+    edit_observer_fn edit_observer;
+    void* edit_context;
+    unshare_fn unshare;         /* set while a save reads buffer[0, shared_start) */
+    void* unshare_context;      /* and buffer[shared_end, buffer_size) in place */
+    size_t shared_start;
+    size_t shared_end;
 
 } Buffer; 
 
 Buffer* create_buffer(void);
+Buffer* create_piece_buffer(void);
+Buffer* create_view_buffer(void);
+size_t buffer_cursor(Buffer* buf);
 void insert_buffer(Buffer* buf, char ch);
+void insert_buffer_n(Buffer* buf, const char* text, size_t length);
 void delete_buffer(Buffer* buf);
 void move_buffer_cursor(Buffer* buf, size_t position);
+void insert_string(Buffer* buf, size_t position, const char* text, size_t length);
+void insert_repeat(Buffer* buf, size_t position, char ch, size_t count);
+void delete_range(Buffer* buf, size_t position, size_t length);
+size_t read_range(Buffer* buf, size_t position, size_t length, char* out);
 void resize_buffer(Buffer* buf, size_t new_size);
+char buffer_char_at(Buffer* buf, size_t position);
+const char* buffer_chunk(Buffer* buf, size_t position, size_t* length);
+/* The contiguous run of text ending at position, at most *length bytes
+ * long: returns its start and sets *length to its size. */
+const char* buffer_chunk_before(Buffer* buf, size_t position, size_t* length);
+size_t buffer_line_count(Buffer* buf);
+int buffer_lines_complete(Buffer* buf);
+/* Piece buffers index the file on worker threads after opening it. While
+ * that runs, buffer_index_pending is true; buffer_poll_index takes up a
+ * finished index and returns 1 once it has. */
+int buffer_index_pending(Buffer* buf);
+int buffer_poll_index(Buffer* buf);
+size_t buffer_line_start(Buffer* buf, size_t line);
+size_t buffer_line_length(Buffer* buf, size_t line);
+size_t buffer_line_of_position(Buffer* buf, size_t position);
+size_t buffer_position_of(Buffer* buf, size_t line, size_t column);
+void buffer_clear_damage(Buffer* buf);
+size_t count_lines(Buffer* buf);
+size_t count_words(Buffer* buf);
+size_t count_non_space_chars(Buffer* buf);
 void free_buffer(Buffer* buf);
 void create_new_file(char filename[]);
-void load_file_into_buffer(char filename[], Buffer* buf, size_t screen_width);
+void load_file_into_buffer(char filename[], Buffer* buf);
 void trim(char filename[]);
-void save_contents_to_file(char filename[], Buffer* buf, size_t screen_width);
+int save_contents_to_file(char filename[], Buffer* buf);
+int save_segments_to_file(const char* filename, const struct iovec* segments, size_t count,
+                          save_progress_fn progress, void* context);
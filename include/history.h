@@ -14,32 +14,77 @@ typedef struct HistoryNode {
     EditType type;
     size_t position;
     char character;
-    size_t screen_x;
-    size_t screen_y;
+    char* text;
+    size_t length;
+    size_t capacity;
+    size_t serial;
     struct HistoryNode* next;
     struct HistoryNode* prev;
+    struct HistoryNode* first_child;
+    struct HistoryNode* last_child;
+    size_t bytes;
+    size_t bytes_through;
 } HistoryNode;
 
+#define HISTORY_SLAB_NODES 512
+
+/* Typing and deleting pauses longer than this start a new undo step. */
+#define HISTORY_MERGE_IDLE_MS 1000
+
+#define HISTORY_DEFAULT_MB 64
+
+/* Span storage above this size is freed rather than kept for reuse when
+ * its node is released. */
+#define HISTORY_KEEP_TEXT_BYTES 4096
+
+/* Nodes are carved out of slabs and recycled through a free list. Released
+ * nodes keep their text allocation so the next span recorded into them can
+ * reuse it, as long as that fits the budget alongside the live steps;
+ * everything is freed together in free_history. A BATCH_EDIT node owns the
+ * chain first_child..last_child, which goes back on the free list when the
+ * batch node itself is reused. */
+typedef struct HistorySlab {
+    struct HistorySlab* next;
+    HistoryNode nodes[HISTORY_SLAB_NODES];
+} HistorySlab;
+
 typedef struct {
     HistoryNode* current;
     HistoryNode* head;
     HistoryNode* tail;
-    int batch_mode;
-    int max_history;
+    int batch_depth;
+    HistoryNode* open_batch;
+    size_t max_bytes;
+    size_t bytes;
+    size_t spare_bytes;         /* span text kept by nodes on the free list */
     int count;
+    size_t next_serial;
+    HistorySlab* slabs;
+    HistoryNode* free_nodes;
+    int span_open;
+    unsigned long long last_record_ms;
 } History;
 
-History* create_history(int max_history);
+/* max_bytes bounds the memory held by undo steps (node plus span storage)
+ * together with the span storage kept for reuse; the oldest steps are
+ * evicted to stay under it, but the newest step is always kept. 0 means
+ * unbounded. */
+History* create_history(size_t max_bytes);
 void free_history(History* history);
 
-void record_insert(History* history, size_t position, char character, size_t x, size_t y);
-void record_delete(History* history, size_t position, char character, size_t x, size_t y);
-void record_enter(History* history, size_t position, size_t x, size_t y);
+void record_insert(History* history, size_t position, char character);
+void record_delete(History* history, size_t position, char character);
+void record_enter(History* history, size_t position);
+void record_insert_text(History* history, size_t position, const char* text, size_t length);
+
+void close_history_span(History* history);
 
+/* Edits recorded between start_batch and end_batch form one undo step.
+ * Batches may nest; only the outermost end_batch closes the step. */
 void start_batch(History* history);
 void end_batch(History* history);
 
-int undo(History* history, Buffer* buf, size_t* x, size_t* y, size_t width);
-int redo(History* history, Buffer* buf, size_t* x, size_t* y, size_t width);
+int undo(History* history, Buffer* buf, size_t* position);
+int redo(History* history, Buffer* buf, size_t* position);
 
 #endif
@@ -0,0 +1,53 @@
+#ifndef INDEXER_H
+#define INDEXER_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* Inputs are split into one chunk per core, but no chunk is smaller than
+ * this; small files are scanned on the calling thread. */
+#define INDEX_MIN_CHUNK (4 * 1024 * 1024)
+#define INDEX_MAX_THREADS 32
+
+/* Caps the number of workers (benchmarks use it to measure scaling); 0
+ * goes back to one per online core. Returns the previous cap. */
+size_t index_use_threads(size_t threads);
+
+/* Returns an array of `front` unused slots followed by base + offset of
+ * every newline in text, with the newline count in *count. Chunks are
+ * counted in parallel, then filled in parallel at their final offsets.
+ * Unless words is NULL, the counting pass also stores the word starts and
+ * non-blank bytes in *words and *non_blank, even if the array cannot be
+ * allocated. NULL if memory runs out. */
+size_t* index_newlines(const char* text, size_t length, size_t base, size_t front, size_t* count,
+                       size_t* words, size_t* non_blank);
+
+/* Indexes a mapped file on a background thread, dropping its pages again
+ * as the scan goes. A full job finds every newline and the word and
+ * character totals; a job with a stride keeps only the start of every
+ * stride-th line (line 0, stride, 2 * stride, ...) and the line total. */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    const char* text;
+    size_t length;
+    size_t stride;
+    size_t* starts;
+    size_t count;
+    size_t lines;
+    size_t words;
+    size_t non_blank;
+    int done;
+    int stop;
+} IndexJob;
+
+IndexJob* start_index_job(const char* text, size_t length, size_t stride);
+int index_job_done(IndexJob* job);
+void wait_index_job(IndexJob* job);
+
+/* Stops the job if it is still running and frees it, including starts
+ * unless the caller took them (and set the field to NULL). */
+void free_index_job(IndexJob* job);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "buffer.h"
+
+/* How long edits may wait in memory before the writer thread flushes and
+ * syncs them, and how much may pile up before it is woken early. */
+#define JOURNAL_SYNC_MS 250
+#define JOURNAL_WAKE_BYTES (64 * 1024)
+
+/* An append-only log of buffer edits kept next to the file being edited
+ * (".<name>.journal"). The header records the size and mtime of the file
+ * the edits apply to, so a journal is only replayed over that exact file.
+ * Edits are queued by the input thread and written by a background
+ * thread, which batches them and calls fdatasync. */
+typedef struct Journal {
+    int fd;
+    char path[4096];
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_mutex_t io_lock;
+    pthread_cond_t wake;
+    char* pending;
+    size_t pending_length;
+    size_t pending_capacity;
+    char* writing;
+    size_t writing_capacity;
+    size_t last_record;
+    off_t checkpoint_offset;
+    int checkpointing;
+    int stop;
+} Journal;
+
+/* Returned by lock_journal when another editor has the file open. */
+#define JOURNAL_BUSY (-2)
+
+/* Opens the journal for filename and takes an exclusive lock on it, so two
+ * editors never replay or append to the same journal. Returns the
+ * descriptor, JOURNAL_BUSY, or -1 on error. */
+int lock_journal(const char* filename);
+
+/* What replay_journal found. A journal written against another version
+ * of the file (its size or mtime changed after a crash) is not replayed
+ * but copied aside, since its edits may exist nowhere else: stale is 1
+ * with the copy's path in stale_path, or -1 if it could not be copied, in
+ * which case the journal must be left alone. */
+typedef struct {
+    size_t replayed;
+    off_t end;
+    int stale;
+    char stale_path[4096 + 16];
+} JournalRecovery;
+
+/* Applies the journal in fd (from lock_journal) to buf, which must hold
+ * the file's contents. recovery->end is the length of the journal up to
+ * the end of the last edit replayed, or 0 if nothing applies. */
+void replay_journal(int fd, const char* filename, Buffer* buf, JournalRecovery* recovery);
+
+/* Starts journaling into fd (from lock_journal), which the journal then
+ * owns. With a keep_length from replay_journal the recovered edits stay,
+ * anything after them (a torn record) is cut off and new ones are
+ * appended; with 0 the journal starts out empty. */
+Journal* open_journal(int fd, const char* filename, off_t keep_length);
+void journal_insert(Journal* journal, size_t position, const char* text, size_t length);
+void journal_delete(Journal* journal, size_t position, size_t length);
+
+/* An edit_observer_fn for a buffer, with the journal as its context: the
+ * buffer reports each edit once it has been applied, so a failed insert
+ * never reaches the journal. */
+void journal_edit(void* context, size_t position, const char* text, size_t length);
+
+/* A save snapshots the buffer, then writes it out. begin marks the point
+ * of the snapshot; commit, once the file is written, rewrites the journal
+ * against the saved file keeping only the edits made after the mark;
+ * cancel forgets the mark after a failed save. */
+void begin_journal_checkpoint(Journal* journal);
+void commit_journal_checkpoint(Journal* journal, const char* filename);
+void cancel_journal_checkpoint(Journal* journal);
+
+/* Flushes and stops the writer. With discard the journal file is removed. */
+void close_journal(Journal* journal, int discard);
+
+#endif
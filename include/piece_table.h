@@ -0,0 +1,123 @@
+#ifndef PIECE_TABLE_H
+#define PIECE_TABLE_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include "indexer.h"
+
+/* The sparse index keeps the start of every SPARSE_LINE_STRIDE-th line. */
+#define SPARSE_LINE_STRIDE 1024
+#define SPARSE_SCAN_BYTES (64 * 1024)
+/* Lines found past the last one asked for, so the next screen is ready. */
+#define SPARSE_LOOKAHEAD_LINES 4096
+
+typedef enum {
+    PIECE_ORIGINAL,
+    PIECE_ADD
+} PieceSource;
+
+/* A run of text from one of the two sources, kept in a treap ordered by
+ * position in the document. Each node carries the byte and newline totals
+ * of its subtree, so positions and lines resolve in O(log pieces). */
+typedef struct Piece {
+    struct Piece* left;
+    struct Piece* right;
+    unsigned int priority;
+    PieceSource source;
+    size_t start;
+    size_t length;
+    size_t newlines;
+    size_t total_length;
+    size_t total_newlines;
+} Piece;
+
+/* The original file is mapped read-only and never copied; inserted text
+ * goes to an append-only add buffer. Newline offsets for both sources are
+ * kept sorted so a piece's newlines can be counted by binary search. The
+ * original's offsets are found by a background job or on first use rather
+ * than at open. */
+typedef struct PieceTable {
+    const char* original;
+    size_t original_size;
+    size_t* original_newlines;
+    size_t original_newline_count;
+    char* add;
+    size_t add_size;
+    size_t add_capacity;
+    size_t* add_newlines;
+    size_t add_newline_count;
+    size_t add_newline_capacity;
+    Piece* root;
+    size_t piece_count;
+    Piece* spare;
+    size_t spare_count;
+    size_t cursor;
+    int indexed;
+    IndexJob* index_job;
+    size_t original_words;
+    size_t original_non_blank;
+    unsigned int seed;
+    size_t* sparse_starts;
+    size_t sparse_count;
+    size_t sparse_capacity;
+    size_t sparse_scanned;
+    size_t sparse_lines;
+    size_t* sparse_newlines;
+    size_t sparse_block;
+    size_t sparse_block_end;
+    size_t sparse_block_count;
+} PieceTable;
+
+PieceTable* create_piece_table(void);
+void free_piece_table(PieceTable* table);
+
+/* Maps filename as the original text, dropping any previous contents.
+ * Returns the file size, or -1 if it cannot be opened or mapped. */
+long long piece_table_open(PieceTable* table, const char* filename);
+
+size_t piece_table_size(PieceTable* table);
+int piece_table_insert(PieceTable* table, size_t position, const char* text, size_t length);
+int piece_table_delete(PieceTable* table, size_t position, size_t length);
+const char* piece_table_chunk(PieceTable* table, size_t position, size_t* length);
+const char* piece_table_chunk_before(PieceTable* table, size_t position, size_t* length);
+size_t piece_table_read(PieceTable* table, size_t position, size_t length, char* out);
+
+/* Finds the newlines of the original file; line queries need it. */
+int piece_table_build_index(PieceTable* table);
+
+/* Starts indexing the original on worker threads: fully, or with sparse
+ * set only the sparse index below. Until the result is taken up by
+ * piece_table_poll_index the table must not be edited. */
+int piece_table_start_index(PieceTable* table, int sparse);
+
+/* Takes up the background index once it is done, waiting for it if asked.
+ * Returns 1 when it was taken up, 0 while it is still running and -1 if
+ * there is none or it failed. A full index also sets original_words and
+ * original_non_blank. */
+int piece_table_poll_index(PieceTable* table, int wait);
+size_t piece_table_line_count(PieceTable* table);
+size_t piece_table_line_start(PieceTable* table, size_t line);
+size_t piece_table_line_of_position(PieceTable* table, size_t position);
+
+/* A lighter line index for the unedited original, used by read-only
+ * views: the file is scanned forward only as far as queries need, one
+ * offset is kept per SPARSE_LINE_STRIDE lines, and the block of line starts
+ * around the last query is decoded on demand. Scanned pages are dropped
+ * from the mapping again, so resident memory follows what is looked at
+ * rather than how far the scan has gone. */
+size_t piece_table_sparse_line_count(PieceTable* table, size_t line);
+size_t piece_table_sparse_line_start(PieceTable* table, size_t line);
+size_t piece_table_sparse_line_of_position(PieceTable* table, size_t position);
+int piece_table_sparse_complete(PieceTable* table);
+
+/* Fills out with the pieces in document order; out must have room for
+ * table->piece_count entries. Returns the number written. */
+size_t piece_table_segments(PieceTable* table, struct iovec* out);
+
+/* Like piece_table_segments, but add-buffer pieces point into add_copy,
+ * which must hold table->add_size bytes and gets the add buffer's text.
+ * The segments then stay valid while the table is edited, since the
+ * mapped original never changes; only inserted text is copied. */
+size_t piece_table_snapshot(PieceTable* table, struct iovec* out, char* add_copy);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+
+typedef enum {
+    RENDER_TEXT,
+    RENDER_DIM,
+    RENDER_REVERSE
+} RenderAttr;
+
+/* The drawing operations the window code needs. utils.c only talks to the
+ * active backend, so the same redraw paths run against a terminal or an
+ * in-memory framebuffer. */
+typedef struct RenderBackend RenderBackend;
+struct RenderBackend {
+    void (*get_size)(RenderBackend* backend, int* rows, int* cols);
+    void (*clear_row)(RenderBackend* backend, int y);
+    void (*put_text)(RenderBackend* backend, int y, int x, const char* text, size_t length, RenderAttr attr);
+    void (*get_cursor)(RenderBackend* backend, int* y, int* x);
+    void (*move_cursor)(RenderBackend* backend, int y, int x);
+    void (*present)(RenderBackend* backend);
+};
+
+typedef struct {
+    char ch;
+    unsigned char attr;
+} FrameCell;
+
+/* A headless cell grid that counts what a terminal would have been sent. */
+typedef struct {
+    RenderBackend base;
+    int rows;
+    int cols;
+    int cursor_y;
+    int cursor_x;
+    FrameCell* cells;
+    size_t cells_written;
+    size_t rows_cleared;
+    size_t frames;
+} Framebuffer;
+
+/* Draws on stdscr; the default backend. */
+RenderBackend* ncurses_backend(void);
+
+Framebuffer* create_framebuffer(int rows, int cols);
+void free_framebuffer(Framebuffer* frame);
+void reset_framebuffer_counters(Framebuffer* frame);
+
+void set_render_backend(RenderBackend* backend);
+RenderBackend* render_backend(void);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SAVER_H
+#define SAVER_H
+
+#include <pthread.h>
+#include "buffer.h"
+
+/* How often the input loop wakes to report progress while a save runs. */
+#define SAVE_POLL_MS 100
+
+typedef enum {
+    SAVE_IDLE,
+    SAVE_RUNNING,
+    SAVE_DONE
+} SaveState;
+
+/* Writes snapshots of the buffer on a background thread. The snapshot is
+ * taken on the input thread, which is the only one that touches the
+ * Buffer; the write, fsync and rename happen off it. A gap buffer is
+ * written straight from its array, and only copied out if the input
+ * thread is about to change those bytes before the write is through. A
+ * piece table's segments point into the mapped original, so only its add
+ * buffer is copied. */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    char filename[4096];
+    char* snapshot;
+    size_t snapshot_capacity;
+    struct iovec* segments;
+    size_t segment_count;
+    size_t segment_capacity;
+    Buffer* shared;             /* gap buffer the segments point into; input
+                                   thread only */
+    int in_place;               /* the worker may still read from it */
+    int unshare_pending;        /* the input thread waits to take it back */
+    int parked;                 /* the worker waits between chunks meanwhile */
+    size_t generation;
+    SaveState state;
+    int result;
+    int follow_up;
+    int stop;
+    size_t written;
+    size_t total;
+} Saver;
+
+Saver* create_saver(const char* filename);
+
+/* Starts a save of buf's current contents and returns 1; the snapshot's
+ * buffer generation is kept in saver->generation. If a save is
+ * already running, a single follow-up is queued instead and 0 returned.
+ * Returns -1 if the snapshot cannot be allocated. */
+int request_save(Saver* saver, Buffer* buf);
+
+/* Reports the state of the current save. On SAVE_DONE the result (0 or -1)
+ * is stored in *result and the saver goes back to SAVE_IDLE; *follow_up
+ * tells whether another save was asked for in the meantime. */
+SaveState poll_save(Saver* saver, size_t* written, size_t* total, int* result, int* follow_up);
+
+/* Waits for a running save to finish and stops the thread. */
+void free_saver(Saver* saver);
+
+#endif
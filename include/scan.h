@@ -0,0 +1,24 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/* Byte-scanning kernels used for full-buffer statistics and for building
+ * the line index. The widest implementation the CPU supports is picked on
+ * first use; scan_use_level lets callers (benchmarks) force a narrower one. */
+typedef enum {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+} ScanLevel;
+
+ScanLevel scan_level(void);
+ScanLevel scan_use_level(ScanLevel level);
+const char* scan_level_name(ScanLevel level);
+
+size_t scan_count_newlines(const char* text, size_t length);
+size_t scan_count_non_blank(const char* text, size_t length);
+size_t scan_count_word_starts(const char* text, size_t length, int in_word);
+size_t scan_newline_positions(const char* text, size_t length, size_t base, size_t* out);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+#include "buffer.h"
+
+#define SEARCH_MAX_PATTERN 256
+
+/* A compiled query. Candidates are found with memchr on one end of the
+ * pattern, and a window that fails to match is skipped past by the
+ * Horspool shift of the byte at its other end. */
+typedef struct {
+    char text[SEARCH_MAX_PATTERN];
+    size_t length;
+    size_t shift[256];       /* forward: keyed by the window's last byte */
+    size_t back_shift[256];  /* backward: keyed by the window's first byte */
+} SearchPattern;
+
+/* Patterns longer than SEARCH_MAX_PATTERN are cut short. */
+void compile_search_pattern(SearchPattern* pattern, const char* text, size_t length);
+
+/* First match wholly inside text, or NULL. */
+const char* search_memory(const SearchPattern* pattern, const char* text, size_t length);
+
+/* The first match starting at or after from, or the last one starting at
+ * or before it. The buffer is searched a segment or piece at a time where
+ * it lies, with only pattern-sized windows copied at the seams. Return 1
+ * and set *match when one is found. */
+int search_forward(Buffer* buf, const SearchPattern* pattern, size_t from, size_t* match);
+int search_backward(Buffer* buf, const SearchPattern* pattern, size_t from, size_t* match);
+
+#endif
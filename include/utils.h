@@ -2,8 +2,12 @@
 #include <stdio.h>
 #include <ncurses.h>
 #include "buffer.h"
+#include "search.h"
 
+/* The minimum gutter; it widens when the line numbers on screen need it. */
 #define LINE_NUMBER_WIDTH 4
+#define TEXT_AREA_WIDTH(buf, width) ((width) - line_number_width(buf) - 1)
+#define TEXT_AREA_HEIGHT(height) ((height) - 2)
 
 typedef enum {
     BACKSPACE = 0x7F,
@@ -25,13 +29,21 @@ typedef struct {
     int status;
 } cursor;
 
-void display_line_number(size_t line_number, size_t y_pos);
+size_t line_number_width(Buffer* buf);
+void display_line_number(Buffer* buf, size_t line_number, size_t y_pos);
+size_t get_buffer_position(Buffer* buf, size_t x_pos, size_t y_pos);
+int scroll_to_position(Buffer* buf, size_t position, size_t* x_pos, size_t* y_pos, size_t width);
+void jump_to_position(Buffer* buf, size_t position, size_t* x_pos, size_t* y_pos, size_t width);
+void scroll_page(Buffer* buf, int direction, size_t* x_pos, size_t* y_pos, size_t width);
 cursor initial_buffer_render_on_window(Buffer* buf, size_t width, size_t height);
+void invalidate_window(void);
+void set_search_highlight(const SearchPattern* pattern);
 void redraw_window(Buffer* buf, size_t width);
-void render_backspace_on_window(Buffer* buf, size_t x_pos, size_t y_pos, size_t width);
+void render_backspace_on_window(Buffer* buf, size_t* x_pos, size_t* y_pos, size_t width);
 void render_delete_on_window(Buffer* buf, size_t x_pos, size_t y_pos, size_t width);
 void render_space_on_window(Buffer* buf, size_t *x_pos, size_t *y_pos, size_t width);
 void render_enter_on_window(Buffer* buf, size_t *x_pos, size_t *y_pos, size_t width);
 void update_general_window(Buffer* buf, size_t* x_pos, size_t* y_pos, int ch, size_t width);
+void render_text_on_window(Buffer* buf, size_t* x_pos, size_t* y_pos, const char* text, size_t length, size_t width);
 void display_status_bar(Buffer* buf, const char* filename, size_t x_pos, size_t y_pos);
 
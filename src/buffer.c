@@ -1,10 +1,312 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "buffer.h"
+#include "scan.h"
+#include "piece_table.h"
+#include "indexer.h"
 #include <ctype.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define LINE_INDEX_INITIAL_CAPACITY 64
+/* How far past the sparse scan a position query may be before it waits
+ * for the background index; see use_full_index. */
+#define SPARSE_WAIT_BYTES (4 * 1024 * 1024)
+
+static int line_index_reserve(LineIndex* lines, size_t needed) {
+    if (lines->gap_end - lines->gap_start >= needed) {
+        return 0;
+    }
+
+    size_t tail = lines->capacity - lines->gap_end;
+    size_t new_capacity = lines->capacity * 2;
+    if (new_capacity < lines->gap_start + tail + needed) {
+        new_capacity = lines->gap_start + tail + needed;
+    }
+
+    size_t* starts = (size_t*)realloc(lines->starts, new_capacity * sizeof(size_t));
+    if (!starts) {
+        perror("Failed to grow line index");
+        return -1;
+    }
+
+    memmove(starts + new_capacity - tail, starts + lines->gap_end, tail * sizeof(size_t));
+    lines->starts = starts;
+    lines->gap_end = new_capacity - tail;
+    lines->capacity = new_capacity;
+    return 0;
+}
+
+static void line_index_reset(LineIndex* lines) {
+    lines->gap_start = 0;
+    lines->gap_end = lines->capacity;
+    lines->starts[lines->gap_start++] = 0;
+}
+
+/* Records the line starts created by newlines in [from, gap_start). */
+static void index_inserted_text(Buffer* buf, size_t from) {
+    size_t length = buf->gap_start - from;
+    size_t newlines = length == 1 ? (buf->buffer[from] == '\n')
+                                  : scan_count_newlines(buf->buffer + from, length);
+    if (newlines == 0 || line_index_reserve(&buf->lines, newlines) < 0) {
+        return;
+    }
+
+    LineIndex* lines = &buf->lines;
+    lines->gap_start += scan_newline_positions(buf->buffer + from, length, from + 1,
+                                               lines->starts + lines->gap_start);
+}
+
+/* Drops line starts whose newline was removed from either side of the gap. */
+static void unindex_deleted_text(Buffer* buf) {
+    LineIndex* lines = &buf->lines;
+
+    while (lines->gap_start > 1 && lines->starts[lines->gap_start - 1] > buf->gap_start) {
+        lines->gap_start--;
+    }
+    while (lines->gap_end < lines->capacity &&
+           lines->starts[lines->gap_end] >= buf->text_size - buf->gap_start) {
+        lines->gap_end++;
+    }
+}
+
+/* Moves line starts across the index gap after the text gap moved. */
+static void line_index_follow_gap(Buffer* buf) {
+    LineIndex* lines = &buf->lines;
+
+    while (lines->gap_start > 1 && lines->starts[lines->gap_start - 1] > buf->gap_start) {
+        size_t start = lines->starts[--lines->gap_start];
+        lines->starts[--lines->gap_end] = buf->text_size - start;
+    }
+    while (lines->gap_end < lines->capacity &&
+           buf->text_size - lines->starts[lines->gap_end] <= buf->gap_start) {
+        size_t start = buf->text_size - lines->starts[lines->gap_end++];
+        lines->starts[lines->gap_start++] = start;
+    }
+}
+
+static int is_word_separator(char c) {
+    return isspace((unsigned char)c) != 0;
+}
+
+/* Adjusts the word and character totals for a span inserted or removed
+ * between the characters at `before` and `after` (NULL at either end of
+ * the text). Only the span and its two neighbours are inspected. */
+static void account_span(Buffer* buf, const char* text, size_t length,
+                         const char* before, const char* after, int inserted) {
+    if (length == 0) return;
+
+    int before_in_word = before && !is_word_separator(*before);
+    size_t words = scan_count_word_starts(text, length, before_in_word);
+    if (after && !is_word_separator(*after)) {
+        int starts_with_span = is_word_separator(text[length - 1]);
+        int starts_without_span = !before_in_word;
+        words += starts_with_span;
+        words -= starts_without_span;
+    }
+    size_t chars = scan_count_non_blank(text, length);
+
+    if (inserted) {
+        buf->word_count += words;
+        buf->non_space_count += chars;
+    } else {
+        buf->word_count -= words;
+        buf->non_space_count -= chars;
+    }
+}
+
+static const char* char_before_gap(Buffer* buf, size_t offset) {
+    return offset > 0 ? buf->buffer + offset - 1 : NULL;
+}
+
+static const char* char_after_gap(Buffer* buf, size_t offset) {
+    return offset < buf->buffer_size ? buf->buffer + offset : NULL;
+}
+
+static void mark_damage(Buffer* buf, size_t first_line, size_t last_line) {
+    if (buf->damage_start > buf->damage_end) {
+        buf->damage_start = first_line;
+        buf->damage_end = last_line;
+        return;
+    }
+    if (first_line < buf->damage_start) buf->damage_start = first_line;
+    if (last_line > buf->damage_end) buf->damage_end = last_line;
+}
+
+/* Called after an edit at the gap with the gap's line and the line count
+ * from before it; an edit that adds or removes newlines shifts every line
+ * below it. Every edit also moves the buffer to a new generation. */
+static void damage_edit(Buffer* buf, size_t line_before, size_t line_count_before) {
+    buf->generation++;
+    
+    size_t line = buf->lines.gap_start - 1;
+    if (line_before < line) {
+        line = line_before;
+    }
+    if (buffer_line_count(buf) != line_count_before) {
+        mark_damage(buf, line, DAMAGE_TO_END);
+    } else {
+        mark_damage(buf, line, line);
+    }
+}
+
+/* account_span for a range already in the buffer, which for a piece table
+ * may cross several pieces. */
+static void account_range(Buffer* buf, size_t position, size_t length, int inserted) {
+    int before_in_word = position > 0 && !is_word_separator(buffer_char_at(buf, position - 1));
+    int in_word = before_in_word;
+    size_t words = 0;
+    size_t chars = 0;
+    char last = ' ';
+
+    size_t done = 0;
+    while (done < length) {
+        size_t chunk_length = length - done;
+        const char* chunk = buffer_chunk(buf, position + done, &chunk_length);
+        if (!chunk) break;
+        words += scan_count_word_starts(chunk, chunk_length, in_word);
+        chars += scan_count_non_blank(chunk, chunk_length);
+        last = chunk[chunk_length - 1];
+        in_word = !is_word_separator(last);
+        done += chunk_length;
+    }
+
+    if (position + length < buf->text_size &&
+        !is_word_separator(buffer_char_at(buf, position + length))) {
+        words += is_word_separator(last);
+        words -= !before_in_word;
+    }
+
+    if (inserted) {
+        buf->word_count += words;
+        buf->non_space_count += chars;
+    } else {
+        buf->word_count -= words;
+        buf->non_space_count -= chars;
+    }
+}
+
+/* Piece-table buffers keep no line gap: lines come from the piece index,
+ * which worker threads build after the file is mapped, so opening costs
+ * only the mmap. The word and character totals come with it. Until it is
+ * taken up, line queries use the sparse scan of the original and the
+ * first edit waits for it. If the job could not be started the index is
+ * built on the first query instead; edits made before that simply damage
+ * the whole window. */
+static int index_pieces(Buffer* buf, int wait) {
+    PieceTable* pieces = buf->pieces;
+    if (pieces->indexed) {
+        return 1;
+    }
+
+    int adopted = piece_table_poll_index(pieces, wait);
+    if (adopted == 0) {
+        return 0;
+    }
+    if (adopted > 0) {
+        buf->word_count = pieces->original_words;
+        buf->non_space_count = pieces->original_non_blank;
+        return 1;
+    }
+
+    if (piece_table_build_index(pieces) < 0) {
+        return 0;
+    }
+    buf->word_count = count_words(buf);
+    buf->non_space_count = count_non_space_chars(buf);
+    return 1;
+}
+
+/* Whether a piece buffer's line queries go to the full index rather than
+ * the sparse scan; views only ever use the sparse one. A query far past
+ * what the sparse scan has reached (a jump to the end, say) waits for the
+ * background index, which scans on every core, instead of scanning up to
+ * it here. */
+static int use_full_index(Buffer* buf, int far) {
+    if (buf->read_only) {
+        piece_table_poll_index(buf->pieces, far);
+        return 0;
+    }
+    return index_pieces(buf, far);
+}
+
+static void damage_piece_edit(Buffer* buf, int indexed, size_t line, size_t line_count_before) {
+    buf->generation++;
+
+    if (!indexed) {
+        mark_damage(buf, 0, DAMAGE_TO_END);
+    } else if (piece_table_line_count(buf->pieces) != line_count_before) {
+        mark_damage(buf, line, DAMAGE_TO_END);
+    } else {
+        mark_damage(buf, line, line);
+    }
+}
+
+/* Called before bytes [start, end) of the gap array are written; a save
+ * still reading any of them in place copies the text out first. */
+static void claim_bytes(Buffer* buf, size_t start, size_t end) {
+    if (buf->unshare && (start < buf->shared_start || end > buf->shared_end)) {
+        unshare_fn unshare = buf->unshare;
+        buf->unshare = NULL;
+        unshare(buf->unshare_context);
+    }
+}
+
+static void notify_edit(Buffer* buf, size_t position, const char* text, size_t length) {
+    if (buf->edit_observer) {
+        buf->edit_observer(buf->edit_context, position, text, length);
+    }
+}
+
+static void insert_pieces(Buffer* buf, size_t position, const char* text, size_t length) {
+    if (buf->read_only) return;
+
+    PieceTable* pieces = buf->pieces;
+    index_pieces(buf, 1);
+    int indexed = pieces->indexed;
+    size_t line = indexed ? piece_table_line_of_position(pieces, position) : 0;
+    size_t line_count = indexed ? piece_table_line_count(pieces) : 0;
+
+    if (piece_table_insert(pieces, position, text, length) < 0) {
+        return;
+    }
+    buf->text_size += length;
+    if (indexed) {
+        account_range(buf, position, length, 1);
+    }
+    damage_piece_edit(buf, indexed, line, line_count);
+    notify_edit(buf, position, text, length);
+}
+
+static void delete_pieces(Buffer* buf, size_t position, size_t length) {
+    if (buf->read_only) return;
+
+    PieceTable* pieces = buf->pieces;
+    index_pieces(buf, 1);
+    int indexed = pieces->indexed;
+    size_t line = indexed ? piece_table_line_of_position(pieces, position) : 0;
+    size_t line_count = indexed ? piece_table_line_count(pieces) : 0;
+
+    if (indexed) {
+        account_range(buf, position, length, 0);
+    }
+    if (piece_table_delete(pieces, position, length) < 0) {
+        if (indexed) {
+            account_range(buf, position, length, 1);
+        }
+        return;
+    }
+    buf->text_size -= length;
+    damage_piece_edit(buf, indexed, line, line_count);
+    notify_edit(buf, position, NULL, length);
+}
 
 Buffer* create_buffer(void) {
     Buffer* gapBuffer = (Buffer*)malloc(sizeof(Buffer));
@@ -17,6 +319,15 @@ Buffer* create_buffer(void) {
     }
     
     memset(gapBuffer->buffer, '\0', INITIAL_BUFFER_SIZE);
+
+    gapBuffer->lines.starts = (size_t*)malloc(sizeof(size_t) * LINE_INDEX_INITIAL_CAPACITY);
+    if (!gapBuffer->lines.starts) {
+        free(gapBuffer->buffer);
+        free(gapBuffer);
+        return NULL;
+    }
+    gapBuffer->lines.capacity = LINE_INDEX_INITIAL_CAPACITY;
+    line_index_reset(&gapBuffer->lines);
     
     gapBuffer->buffer_size = INITIAL_BUFFER_SIZE;
     gapBuffer->gap_start = 0;
@@ -24,29 +335,143 @@ Buffer* create_buffer(void) {
     gapBuffer->text_size = 0;
     gapBuffer->first_character = 0;
     gapBuffer->last_character = 0;
+    gapBuffer->first_line = 0;
+    gapBuffer->first_column = 0;
+    gapBuffer->word_count = 0;
+    gapBuffer->non_space_count = 0;
+    gapBuffer->damage_start = 0;
+    gapBuffer->damage_end = DAMAGE_TO_END;
+    gapBuffer->generation = 0;
+    gapBuffer->saved_generation = 0;
+    gapBuffer->pieces = NULL;
+    gapBuffer->read_only = 0;
+    gapBuffer->edit_observer = NULL;
+    gapBuffer->edit_context = NULL;
+    gapBuffer->unshare = NULL;
+    gapBuffer->unshare_context = NULL;
+    gapBuffer->shared_start = 0;
+    gapBuffer->shared_end = 0;
     
     return gapBuffer;
 }
 
-void insert_buffer(Buffer* buf, char ch) {
+Buffer* create_piece_buffer(void) {
+    Buffer* buf = create_buffer();
+    if (!buf) return NULL;
+
+    buf->pieces = create_piece_table();
+    if (!buf->pieces) {
+        free_buffer(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/* A read-only piece buffer over the mapped file; see the sparse index in
+ * piece_table.h. */
+Buffer* create_view_buffer(void) {
+    Buffer* buf = create_piece_buffer();
     if (buf) {
+        buf->read_only = 1;
+    }
+    return buf;
+}
+
+/* Where the last edit or cursor move left off. */
+size_t buffer_cursor(Buffer* buf) {
+    if (!buf) return 0;
+    return buf->pieces ? buf->pieces->cursor : buf->gap_start;
+}
+
+static void reserve_gap(Buffer* buf, size_t needed) {
+    size_t gap = buf->gap_end - buf->gap_start;
+    if (gap >= needed) {
+        return;
+    }
+
+    size_t min_gap = (buf->text_size + needed) / GAP_GROWTH_DIVISOR;
+    if (min_gap < GAP_SIZE) {
+        min_gap = GAP_SIZE;
+    }
+
+    resize_buffer(buf, buf->text_size + needed + min_gap);
+}
+
+void insert_buffer(Buffer* buf, char ch) {
+    if (buf && buf->pieces) {
+        insert_pieces(buf, buf->pieces->cursor, &ch, 1);
+    } else if (buf) {
         if (buf->gap_start == buf->gap_end) {
-            resize_buffer(buf, buf->buffer_size + GAP_SIZE);
+            reserve_gap(buf, 1);
+            if (buf->gap_start == buf->gap_end) {
+                return;
+            }
         }
+        size_t line = buf->lines.gap_start - 1;
+        size_t line_count = buffer_line_count(buf);
+        claim_bytes(buf, buf->gap_start, buf->gap_start + 1);
         buf->buffer[buf->gap_start] = ch;
+        account_span(buf, buf->buffer + buf->gap_start, 1,
+                     char_before_gap(buf, buf->gap_start), char_after_gap(buf, buf->gap_end), 1);
         buf->gap_start++;
         buf->text_size++;
+        if (ch == '\n') {
+            index_inserted_text(buf, buf->gap_start - 1);
+        }
+        damage_edit(buf, line, line_count);
+        notify_edit(buf, buf->gap_start - 1, &ch, 1);
     } else {
         perror("Error inserting character into buffer module");
     }
 }
 
+void insert_buffer_n(Buffer* buf, const char* text, size_t length) {
+    if (!buf || (!text && length > 0)) {
+        perror("Error inserting text into buffer module");
+        return;
+    }
+    if (length == 0) {
+        return;
+    }
+    if (buf->pieces) {
+        insert_pieces(buf, buf->pieces->cursor, text, length);
+        return;
+    }
+
+    reserve_gap(buf, length);
+    if (buf->gap_end - buf->gap_start < length) {
+        return;
+    }
+
+    size_t line = buf->lines.gap_start - 1;
+    size_t line_count = buffer_line_count(buf);
+    claim_bytes(buf, buf->gap_start, buf->gap_start + length);
+    memcpy(buf->buffer + buf->gap_start, text, length);
+    account_span(buf, buf->buffer + buf->gap_start, length,
+                 char_before_gap(buf, buf->gap_start), char_after_gap(buf, buf->gap_end), 1);
+    buf->gap_start += length;
+    buf->text_size += length;
+    index_inserted_text(buf, buf->gap_start - length);
+    damage_edit(buf, line, line_count);
+    notify_edit(buf, buf->gap_start - length, text, length);
+}
+
 void delete_buffer(Buffer* buf) {
-    if (buf) {
+    if (buf && buf->pieces) {
+        if (buf->pieces->cursor > 0) {
+            delete_pieces(buf, buf->pieces->cursor - 1, 1);
+        }
+    } else if (buf) {
         if (buf->gap_start > 0) {
-            buf->buffer[buf->gap_start] = '\0';
+            size_t line = buf->lines.gap_start - 1;
+            size_t line_count = buffer_line_count(buf);
+            account_span(buf, buf->buffer + buf->gap_start - 1, 1,
+                         char_before_gap(buf, buf->gap_start - 1), char_after_gap(buf, buf->gap_end), 0);
             buf->gap_start--;
             buf->text_size--;
+            unindex_deleted_text(buf);
+            damage_edit(buf, line, line_count);
+            notify_edit(buf, buf->gap_start, NULL, 1);
         }
     } else {
         perror("Error deleting character from buffer module");
@@ -57,43 +482,392 @@ void move_buffer_cursor(Buffer* buf, size_t position) {
     if (!buf || position > buf->text_size) {
         return;
     }
+    if (buf->pieces) {
+        buf->pieces->cursor = position;
+        return;
+    }
 
     if (position < buf->gap_start) {
         size_t move_size = buf->gap_start - position; 
+        claim_bytes(buf, buf->gap_end - move_size, buf->gap_end);
         memmove(buf->buffer + buf->gap_end - move_size, buf->buffer + position, move_size); 
         buf->gap_start = position;
         buf->gap_end -= move_size;
     } else if (position > buf->gap_start) {
         size_t move_size = position - buf->gap_start;
+        claim_bytes(buf, buf->gap_start, buf->gap_start + move_size);
         memmove(buf->buffer + buf->gap_start, buf->buffer + buf->gap_end, move_size);
         buf->gap_start = position;
         buf->gap_end += move_size;
     }
+
+    line_index_follow_gap(buf);
+}
+
+
+void insert_string(Buffer* buf, size_t position, const char* text, size_t length) {
+    if (!buf || position > buf->text_size) {
+        return;
+    }
+    if (buf->pieces) {
+        if (text && length > 0) {
+            insert_pieces(buf, position, text, length);
+        }
+        return;
+    }
+
+    move_buffer_cursor(buf, position);
+    insert_buffer_n(buf, text, length);
+}
+
+void insert_repeat(Buffer* buf, size_t position, char ch, size_t count) {
+    if (!buf || position > buf->text_size || count == 0) {
+        return;
+    }
+    if (buf->pieces) {
+        char* text = (char*)malloc(count);
+        if (!text) {
+            perror("Failed to allocate repeated text");
+            return;
+        }
+        memset(text, ch, count);
+        insert_pieces(buf, position, text, count);
+        free(text);
+        return;
+    }
+
+    move_buffer_cursor(buf, position);
+    reserve_gap(buf, count);
+    if (buf->gap_end - buf->gap_start < count) {
+        return;
+    }
+
+    size_t line = buf->lines.gap_start - 1;
+    size_t line_count = buffer_line_count(buf);
+    claim_bytes(buf, buf->gap_start, buf->gap_start + count);
+    memset(buf->buffer + buf->gap_start, ch, count);
+    account_span(buf, buf->buffer + buf->gap_start, count,
+                 char_before_gap(buf, buf->gap_start), char_after_gap(buf, buf->gap_end), 1);
+    buf->gap_start += count;
+    buf->text_size += count;
+    if (ch == '\n') {
+        index_inserted_text(buf, buf->gap_start - count);
+    }
+    damage_edit(buf, line, line_count);
+    notify_edit(buf, position, buf->buffer + position, count);
+}
+
+void delete_range(Buffer* buf, size_t position, size_t length) {
+    if (!buf || position >= buf->text_size || length == 0) {
+        return;
+    }
+    if (length > buf->text_size - position) {
+        length = buf->text_size - position;
+    }
+    if (buf->pieces) {
+        delete_pieces(buf, position, length);
+        return;
+    }
+
+    move_buffer_cursor(buf, position);
+    size_t line = buf->lines.gap_start - 1;
+    size_t line_count = buffer_line_count(buf);
+    account_span(buf, buf->buffer + buf->gap_end, length,
+                 char_before_gap(buf, buf->gap_start), char_after_gap(buf, buf->gap_end + length), 0);
+    buf->gap_end += length;
+    buf->text_size -= length;
+    unindex_deleted_text(buf);
+    damage_edit(buf, line, line_count);
+    notify_edit(buf, position, NULL, length);
 }
 
+size_t read_range(Buffer* buf, size_t position, size_t length, char* out) {
+    if (!buf || !out || position >= buf->text_size) {
+        return 0;
+    }
+    if (length > buf->text_size - position) {
+        length = buf->text_size - position;
+    }
+    if (buf->pieces) {
+        return piece_table_read(buf->pieces, position, length, out);
+    }
+
+    size_t copied = 0;
+    if (position < buf->gap_start) {
+        size_t before_gap = buf->gap_start - position;
+        if (before_gap > length) {
+            before_gap = length;
+        }
+        memcpy(out, buf->buffer + position, before_gap);
+        copied = before_gap;
+        position += before_gap;
+    }
+
+    if (copied < length) {
+        size_t offset = buf->gap_end + (position - buf->gap_start);
+        memcpy(out + copied, buf->buffer + offset, length - copied);
+        copied = length;
+    }
+
+    return copied;
+}
 
 void resize_buffer(Buffer* buf, size_t new_size) {
-    if (new_size <= buf->buffer_size) {
+    if (buf->pieces || new_size <= buf->buffer_size || new_size <= buf->text_size) {
         return;
     }
-    else if (new_size > buf->text_size) {
 
-        size_t new_gap_end = buf->gap_start + GAP_SIZE;
+    size_t tail_size = buf->buffer_size - buf->gap_end;
+    size_t new_gap_end = new_size - tail_size;
+    claim_bytes(buf, 0, SIZE_MAX);
+
+    char* new_buffer = (char*) realloc(buf->buffer, new_size * sizeof(char));
+    if (!new_buffer) {
+        perror("Failed to reallocate memory");
+        return;
+    }
+
+    memmove(new_buffer + new_gap_end, new_buffer + buf->gap_end, tail_size);
+
+    buf->buffer = new_buffer;
+    buf->gap_end = new_gap_end;
+    buf->buffer_size = new_size;
+}
+
+char buffer_char_at(Buffer* buf, size_t position) {
+    if (!buf || position >= buf->text_size) {
+        return '\0';
+    }
+    if (buf->pieces) {
+        size_t length = 1;
+        const char* chunk = piece_table_chunk(buf->pieces, position, &length);
+        return chunk ? *chunk : '\0';
+    }
+    if (position < buf->gap_start) {
+        return buf->buffer[position];
+    }
+    return buf->buffer[buf->gap_end + (position - buf->gap_start)];
+}
+
+/* Returns the bytes stored contiguously from position, trimming *length
+ * to the end of that run; callers loop to cross the gap. */
+const char* buffer_chunk(Buffer* buf, size_t position, size_t* length) {
+    if (!buf || position >= buf->text_size) {
+        *length = 0;
+        return NULL;
+    }
+    if (buf->pieces) {
+        return piece_table_chunk(buf->pieces, position, length);
+    }
+
+    size_t available;
+    const char* chunk;
+    if (position < buf->gap_start) {
+        chunk = buf->buffer + position;
+        available = buf->gap_start - position;
+    } else {
+        chunk = buf->buffer + buf->gap_end + (position - buf->gap_start);
+        available = buf->text_size - position;
+    }
+
+    if (*length > available) {
+        *length = available;
+    }
+    return chunk;
+}
+
+const char* buffer_chunk_before(Buffer* buf, size_t position, size_t* length) {
+    if (!buf || position == 0 || position > buf->text_size) {
+        *length = 0;
+        return NULL;
+    }
+    if (buf->pieces) {
+        return piece_table_chunk_before(buf->pieces, position, length);
+    }
+
+    size_t available;
+    const char* end;
+    if (position <= buf->gap_start) {
+        end = buf->buffer + position;
+        available = position;
+    } else {
+        end = buf->buffer + buf->gap_end + (position - buf->gap_start);
+        available = position - buf->gap_start;
+    }
+
+    if (*length > available) {
+        *length = available;
+    }
+    return end - *length;
+}
+
+size_t buffer_line_count(Buffer* buf) {
+    if (!buf) return 0;
+    if (buf->pieces) {
+        if (use_full_index(buf, 0)) {
+            return piece_table_line_count(buf->pieces);
+        }
+        /* Lines known so far, which always reach past the window. */
+        return piece_table_sparse_line_count(buf->pieces, buf->first_line);
+    }
+    return buf->lines.gap_start + (buf->lines.capacity - buf->lines.gap_end);
+}
+
+/* Whether buffer_line_count is the final count; the sparse scan may not
+ * have reached the end of the file yet. */
+int buffer_lines_complete(Buffer* buf) {
+    if (!buf || !buf->pieces) return 1;
+    return use_full_index(buf, 0) || piece_table_sparse_complete(buf->pieces);
+}
+
+int buffer_index_pending(Buffer* buf) {
+    return buf && buf->pieces && buf->pieces->index_job;
+}
+
+int buffer_poll_index(Buffer* buf) {
+    if (!buffer_index_pending(buf)) return 0;
+
+    use_full_index(buf, 0);
+    return !buffer_index_pending(buf);
+}
+
+size_t buffer_line_start(Buffer* buf, size_t line) {
+    if (!buf) return 0;
+    if (buf->pieces) {
+        if (use_full_index(buf, line > buf->pieces->sparse_lines + SPARSE_LOOKAHEAD_LINES)) {
+            return piece_table_line_start(buf->pieces, line);
+        }
+        return piece_table_sparse_line_start(buf->pieces, line);
+    }
+
+    LineIndex* lines = &buf->lines;
+    if (line < lines->gap_start) {
+        return lines->starts[line];
+    }
+
+    size_t index = lines->gap_end + (line - lines->gap_start);
+    if (index >= lines->capacity) {
+        return buf->text_size;
+    }
+    return buf->text_size - lines->starts[index];
+}
+
+size_t buffer_line_length(Buffer* buf, size_t line) {
+    if (!buf) return 0;
+
+    /* Looking the line up first lets the sparse scan go far enough to know it. */
+    size_t start = buffer_line_start(buf, line);
+    size_t line_count = buffer_line_count(buf);
+    if (line >= line_count) return 0;
+    if (line + 1 == line_count) {
+        return buf->text_size - start;
+    }
+    return buffer_line_start(buf, line + 1) - 1 - start;
+}
+
+size_t buffer_line_of_position(Buffer* buf, size_t position) {
+    if (!buf) return 0;
+    if (buf->pieces) {
+        if (use_full_index(buf, position > buf->pieces->sparse_scanned + SPARSE_WAIT_BYTES)) {
+            return piece_table_line_of_position(buf->pieces, position);
+        }
+        return piece_table_sparse_line_of_position(buf->pieces, position);
+    }
+
+    size_t low = 0;
+    size_t high = buffer_line_count(buf);
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (buffer_line_start(buf, mid) <= position) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+size_t buffer_position_of(Buffer* buf, size_t line, size_t column) {
+    if (!buf) return 0;
+
+    if (buf->pieces) {
+        buffer_line_start(buf, line);
+    }
+    size_t line_count = buffer_line_count(buf);
+    if (line >= line_count) {
+        line = line_count - 1;
+    }
+
+    size_t length = buffer_line_length(buf, line);
+    if (column > length) {
+        column = length;
+    }
+    return buffer_line_start(buf, line) + column;
+}
+
+void buffer_clear_damage(Buffer* buf) {
+    if (!buf) return;
+    buf->damage_start = DAMAGE_TO_END;
+    buf->damage_end = 0;
+}
 
-        char* new_buffer = (char*) realloc(buf->buffer, new_size * sizeof(char));
-        if (!new_buffer) {
-            perror("Failed to reallocate memory");
+size_t count_lines(Buffer* buf) {
+    if (!buf || buf->text_size == 0) return 0;
+    if (buf->pieces) {
+        size_t lines = 1;
+        for (size_t position = 0, length; position < buf->text_size; position += length) {
+            length = buf->text_size - position;
+            const char* chunk = buffer_chunk(buf, position, &length);
+            lines += scan_count_newlines(chunk, length);
         }
-        
-        memmove(new_buffer + new_gap_end, new_buffer + buf->gap_end, buf->buffer_size - buf->gap_end);
+        return lines;
+    }
+    
+    return 1 + scan_count_newlines(buf->buffer, buf->gap_start) +
+           scan_count_newlines(buf->buffer + buf->gap_end, buf->buffer_size - buf->gap_end);
+}
 
-        buf->buffer = new_buffer;
-        buf->gap_end = new_gap_end;
-        buf->buffer_size = new_size;
+size_t count_words(Buffer* buf) {
+    if (!buf || buf->text_size == 0) return 0;
+    if (buf->pieces) {
+        size_t words = 0;
+        int in_word = 0;
+        for (size_t position = 0, length; position < buf->text_size; position += length) {
+            length = buf->text_size - position;
+            const char* chunk = buffer_chunk(buf, position, &length);
+            words += scan_count_word_starts(chunk, length, in_word);
+            in_word = !is_word_separator(chunk[length - 1]);
+        }
+        return words;
     }
+    
+    size_t word_count = scan_count_word_starts(buf->buffer, buf->gap_start, 0);
+    int in_word = buf->gap_start > 0 && !is_word_separator(buf->buffer[buf->gap_start - 1]);
+    word_count += scan_count_word_starts(buf->buffer + buf->gap_end, buf->buffer_size - buf->gap_end, in_word);
+    
+    return word_count;
+}
+
+size_t count_non_space_chars(Buffer* buf) {
+    if (!buf || buf->text_size == 0) return 0;
+    if (buf->pieces) {
+        size_t chars = 0;
+        for (size_t position = 0, length; position < buf->text_size; position += length) {
+            length = buf->text_size - position;
+            const char* chunk = buffer_chunk(buf, position, &length);
+            chars += scan_count_non_blank(chunk, length);
+        }
+        return chars;
+    }
+    
+    return scan_count_non_blank(buf->buffer, buf->gap_start) +
+           scan_count_non_blank(buf->buffer + buf->gap_end, buf->buffer_size - buf->gap_end);
 }
 
 void free_buffer(Buffer* buf) {
+    claim_bytes(buf, 0, SIZE_MAX);
+    free_piece_table(buf->pieces);
+    free(buf->lines.starts);
     free(buf->buffer);
     free(buf);
 }
@@ -108,60 +882,118 @@ void create_new_file(char filename[]) {
     }
 }
 
-void load_file_into_buffer(char filename[], Buffer* buf, size_t screen_width) {
+static int read_fully(int fd, char* dest, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = read(fd, dest + total, size - total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        total += (size_t)n;
+    }
+    return total == size ? 0 : -1;
+}
+
+/* Maps the file instead of reading it and leaves the line index to a
+ * background job; see index_pieces. */
+static void load_file_into_pieces(char filename[], Buffer* buf) {
+    if (!buf->read_only && access(filename, F_OK) < 0 && errno == ENOENT) {
+        create_new_file(filename);
+    }
+
+    long long size = piece_table_open(buf->pieces, filename);
+    if (size < 0) {
+        return;
+    }
+
+    buf->text_size = (size_t)size;
+    buf->first_character = 0;
+    buf->last_character = 0;
+    buf->first_line = 0;
+    buf->first_column = 0;
+    buf->word_count = 0;
+    buf->non_space_count = 0;
+    piece_table_start_index(buf->pieces, buf->read_only);
+
+    mark_damage(buf, 0, DAMAGE_TO_END);
+    buf->generation++;
+    buf->saved_generation = buf->generation;
+}
+
+void load_file_into_buffer(char filename[], Buffer* buf) {
     if (!buf || !filename) {
         fprintf(stderr, "Error: Invalid buffer or filename\n");
         return;
     }
+    if (buf->pieces) {
+        load_file_into_pieces(filename, buf);
+        return;
+    }
+    claim_bytes(buf, 0, SIZE_MAX);
 
-    FILE* file = fopen(filename, "r+");
-    if (!file) {
-        file = fopen(filename, "r");
-        if (!file) {
-            create_new_file(filename);
-            file = fopen(filename, "r");
-            if (!file) {
-                perror("Error opening/creating file");
-                return;
-            }
-        }
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0 && errno == ENOENT) {
+        create_new_file(filename);
+        fd = open(filename, O_RDONLY);
     }
+    if (fd < 0) {
+        perror("Error opening/creating file");
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Error reading file size");
+        close(fd);
+        return;
+    }
+    size_t file_size = (size_t)st.st_size;
 
     buf->text_size = 0;
     buf->gap_start = 0;
-    buf->gap_end = INITIAL_BUFFER_SIZE - GAP_SIZE;
+    buf->gap_end = buf->buffer_size;
     buf->first_character = 0;
     buf->last_character = 0;
+    buf->first_line = 0;
+    buf->first_column = 0;
+    buf->word_count = 0;
+    buf->non_space_count = 0;
+    line_index_reset(&buf->lines);
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    size_t needed_size = file_size + screen_width * 2;
-    if (needed_size > buf->buffer_size) {
-        resize_buffer(buf, needed_size);
+    resize_buffer(buf, file_size + file_size / GAP_GROWTH_DIVISOR + GAP_SIZE);
+    if (buf->buffer_size < file_size || read_fully(fd, buf->buffer, file_size) < 0) {
+        perror("Error reading file");
+        close(fd);
+        return;
     }
+    close(fd);
 
-    int ch;
-    int x_pos = 1;
-    while ((ch = fgetc(file)) != EOF) {
-        if (ch == '\n') {
-            size_t spaces_needed = screen_width - (x_pos - 1);
-            for (size_t i = 0; i < spaces_needed; i++) {
-                insert_buffer(buf, ' ');
-            }
-            x_pos = 1;
-        } else {
-            insert_buffer(buf, ch);
-            x_pos++;
-            
-            if (x_pos >= (int)(screen_width - 1)) {
-                x_pos = 1;
-            }
-        }
+    buf->gap_start = file_size;
+    buf->gap_end = buf->buffer_size;
+    buf->text_size = file_size;
+
+    /* The loaded text is a single run before the gap, so its line starts
+     * are the whole index; the totals come from the same counting pass. */
+    size_t newlines;
+    size_t* starts = index_newlines(buf->buffer, file_size, 1, 1, &newlines,
+                                    &buf->word_count, &buf->non_space_count);
+    if (starts) {
+        starts[0] = 0;
+        free(buf->lines.starts);
+        buf->lines.starts = starts;
+        buf->lines.capacity = newlines + 1;
+        buf->lines.gap_start = newlines + 1;
+        buf->lines.gap_end = newlines + 1;
+    } else {
+        line_index_reset(&buf->lines);
+        index_inserted_text(buf, 0);
     }
 
-    fclose(file);
+    mark_damage(buf, 0, DAMAGE_TO_END);
+    buf->generation++;
+    buf->saved_generation = buf->generation;
 }
 
 
@@ -192,89 +1024,157 @@ void trim(char filename[]) {
     fclose(file);
 }
 
-void save_contents_to_file(char filename[], Buffer* buf, size_t screen_width) {
-    if (!filename || !buf) {
-        fprintf(stderr, "Error: Invalid filename or buffer\n");
-        return;
+/* writev takes at most IOV_MAX entries; a piece table can have far more. */
+#define WRITE_IOV_BATCH 64
+
+/* Writes the segments in order with writev, at most SAVE_CHUNK_BYTES per
+ * call so progress can be reported between calls. */
+static int write_segments(int fd, const struct iovec* segments, size_t count,
+                          save_progress_fn progress, void* context) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += segments[i].iov_len;
     }
-    
-    FILE* file = fopen(filename, "r+");
 
-    if (!file) {
-        file = fopen(filename, "w");
-        if (!file) {
-            perror("Error opening/creating file");
-            return;
+    size_t done = 0;
+    size_t index = 0;
+    size_t offset = 0;
+    while (done < total) {
+        struct iovec iov[WRITE_IOV_BATCH];
+        int batch = 0;
+        size_t chunk = 0;
+
+        for (size_t i = index, from = offset;
+             i < count && batch < WRITE_IOV_BATCH && chunk < SAVE_CHUNK_BYTES; i++, from = 0) {
+            size_t n = segments[i].iov_len - from;
+            if (n > SAVE_CHUNK_BYTES - chunk) n = SAVE_CHUNK_BYTES - chunk;
+            if (n == 0) continue;
+            iov[batch].iov_base = (char*)segments[i].iov_base + from;
+            iov[batch].iov_len = n;
+            batch++;
+            chunk += n;
         }
-    }
 
-    char* temp_buffer = (char*)malloc(buf->text_size + buf->text_size/screen_width + 1);
-    if (!temp_buffer) {
-        perror("Failed to allocate memory for saving");
-        fclose(file);
-        return;
-    }
-    
-    size_t temp_index = 0;
-    size_t line_pos = 0;
-    int last_was_space = 0;
-    
-    for (size_t i = 0; i < buf->gap_start; i++) {
-        char ch = buf->buffer[i];
-        
-        if (line_pos >= screen_width - 2) {
-            temp_buffer[temp_index++] = '\n';
-            line_pos = 0;
-            last_was_space = 1;
-            continue;
+        ssize_t written = writev(fd, iov, batch);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
         }
-        
-        if (ch == ' ') {
-            if (!last_was_space) {
-                temp_buffer[temp_index++] = ch;
-            }
-            last_was_space = 1;
-        } else {
-            temp_buffer[temp_index++] = ch;
-            last_was_space = 0;
+        if (written == 0) {
+            /* No progress and no error: retrying would spin forever. */
+            errno = EIO;
+            return -1;
+        }
+        done += (size_t)written;
+
+        size_t advance = (size_t)written;
+        while (index < count && advance >= segments[index].iov_len - offset) {
+            advance -= segments[index].iov_len - offset;
+            index++;
+            offset = 0;
+        }
+        offset += advance;
+
+        if (progress) {
+            progress(context, done, total);
         }
-        
-        line_pos++;
     }
-    
-    for (size_t i = buf->gap_end; i < buf->buffer_size && buf->buffer[i] != '\0'; i++) {
-        char ch = buf->buffer[i];
-        
-        if (line_pos >= screen_width - 2) {
-            temp_buffer[temp_index++] = '\n';
-            line_pos = 0;
-            last_was_space = 1;
-            continue;
+    return 0;
+}
+
+/* Writes the text into a temporary file in the same directory, syncs it and
+ * renames it over the original, so the file on disk is always either the
+ * old or the new version in full. The text is taken as segments so a gap
+ * buffer or piece table can be written without first being copied
+ * together. */
+int save_segments_to_file(const char* filename, const struct iovec* segments, size_t count,
+                          save_progress_fn progress, void* context) {
+    if (!filename) {
+        fprintf(stderr, "Error: Invalid filename\n");
+        return -1;
+    }
+
+    char target[PATH_MAX];
+    struct stat st;
+    int exists = stat(filename, &st) == 0;
+
+    /* Replace what a symlink points at, not the link itself. */
+    if (!realpath(filename, target)) {
+        if (exists || strlen(filename) >= sizeof(target)) {
+            perror("Error resolving file path");
+            return -1;
         }
-        
-        if (ch == ' ') {
-            if (!last_was_space) {
-                temp_buffer[temp_index++] = ch;
-            }
-            last_was_space = 1;
-        } else {
-            temp_buffer[temp_index++] = ch;
-            last_was_space = 0;
+        strcpy(target, filename);
+    }
+
+    char temp_path[PATH_MAX + 16];
+    char* slash = strrchr(target, '/');
+    size_t dir_length = slash ? (size_t)(slash - target) + 1 : 0;
+    snprintf(temp_path, sizeof(temp_path), "%.*s.textura-XXXXXX", (int)dir_length, target);
+
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        perror("Error creating temporary file");
+        return -1;
+    }
+
+    mode_t mode;
+    if (exists) {
+        mode = st.st_mode & 07777;
+        if (fchown(fd, st.st_uid, st.st_gid) < 0) {
+            /* Not fatal: without privileges the file is simply owned by us. */
         }
-        
-        line_pos++;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0666 & ~mask;
     }
-    
-    temp_buffer[temp_index] = '\0';
-    
-    rewind(file);
-    fputs(temp_buffer, file);
-    
-    int fd = fileno(file);
-    if (fd != -1) {
-        ftruncate(fd, ftell(file));
+
+    if (fchmod(fd, mode) < 0 ||
+        write_segments(fd, segments, count, progress, context) < 0 ||
+        fsync(fd) < 0) {
+        perror("Error writing file");
+        close(fd);
+        unlink(temp_path);
+        return -1;
     }
-    
-    free(temp_buffer);
-    fclose(file);
+    if (close(fd) < 0 || rename(temp_path, target) < 0) {
+        perror("Error replacing file");
+        unlink(temp_path);
+        return -1;
+    }
+
+    /* Make the rename itself durable. */
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%.*s", dir_length ? (int)dir_length : 1, dir_length ? target : ".");
+    int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    return 0;
+}
+
+int save_contents_to_file(char filename[], Buffer* buf) {
+    if (!buf) {
+        fprintf(stderr, "Error: Invalid buffer\n");
+        return -1;
+    }
+    if (buf->pieces) {
+        struct iovec* segments = (struct iovec*)malloc((buf->pieces->piece_count + 1) * sizeof(struct iovec));
+        if (!segments) {
+            perror("Failed to allocate save segments");
+            return -1;
+        }
+        size_t count = piece_table_segments(buf->pieces, segments);
+        int result = save_segments_to_file(filename, segments, count, NULL, NULL);
+        free(segments);
+        return result;
+    }
+    struct iovec segments[2] = {
+        {buf->buffer, buf->gap_start},
+        {buf->buffer + buf->gap_end, buf->text_size - buf->gap_start}
+    };
+    return save_segments_to_file(filename, segments, 2, NULL, NULL);
 }
@@ -1,11 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
 #include "history.h"
 #include "buffer.h"
-#include "utils.h"
 
-History* create_history(int max_history) {
+History* create_history(size_t max_bytes) {
     History* history = (History*)malloc(sizeof(History));
     if (!history) {
         perror("Failed to allocate memory for history");
@@ -15,9 +16,17 @@ History* create_history(int max_history) {
     history->current = NULL;
     history->head = NULL;
     history->tail = NULL;
-    history->batch_mode = 0;
-    history->max_history = max_history;
+    history->batch_depth = 0;
+    history->open_batch = NULL;
+    history->max_bytes = max_bytes;
+    history->bytes = 0;
+    history->spare_bytes = 0;
     history->count = 0;
+    history->next_serial = 0;
+    history->slabs = NULL;
+    history->free_nodes = NULL;
+    history->span_open = 0;
+    history->last_record_ms = 0;
     
     return history;
 }
@@ -25,34 +34,251 @@ History* create_history(int max_history) {
 void free_history(History* history) {
     if (!history) return;
     
-    HistoryNode* current = history->head;
-    while (current) {
-        HistoryNode* next = current->next;
-        free(current);
-        current = next;
+    HistorySlab* slab = history->slabs;
+    while (slab) {
+        HistorySlab* next = slab->next;
+        for (size_t i = 0; i < HISTORY_SLAB_NODES; i++) {
+            free(slab->nodes[i].text);
+        }
+        free(slab);
+        slab = next;
     }
     
     free(history);
 }
 
+static HistoryNode* alloc_history_node(History* history) {
+    if (!history->free_nodes) {
+        HistorySlab* slab = (HistorySlab*)malloc(sizeof(HistorySlab));
+        if (!slab) {
+            perror("Failed to allocate memory for history node");
+            return NULL;
+        }
+        
+        slab->next = history->slabs;
+        history->slabs = slab;
+        
+        for (size_t i = 0; i < HISTORY_SLAB_NODES; i++) {
+            slab->nodes[i].text = NULL;
+            slab->nodes[i].capacity = 0;
+            slab->nodes[i].first_child = NULL;
+            slab->nodes[i].next = i + 1 < HISTORY_SLAB_NODES ? &slab->nodes[i + 1] : NULL;
+        }
+        history->free_nodes = &slab->nodes[0];
+    }
+    
+    HistoryNode* node = history->free_nodes;
+    history->free_nodes = node->next;
+    history->spare_bytes -= node->capacity;
+    
+    /* The children's text was counted as spare when the batch was released. */
+    if (node->first_child) {
+        node->last_child->next = history->free_nodes;
+        history->free_nodes = node->first_child;
+    }
+    
+    node->first_child = NULL;
+    node->last_child = NULL;
+    node->length = 1;
+    return node;
+}
+
+/* Keeps a released node's text for reuse if it is small and fits the
+ * budget next to the live steps, and frees it otherwise. */
+static void release_node_text(History* history, HistoryNode* node) {
+    size_t total = history->bytes + history->spare_bytes + node->capacity;
+    if (node->capacity > HISTORY_KEEP_TEXT_BYTES || (history->max_bytes > 0 && total > history->max_bytes)) {
+        free(node->text);
+        node->text = NULL;
+        node->capacity = 0;
+    }
+    history->spare_bytes += node->capacity;
+}
+
+/* Returns the chain first..last to the free list. history->bytes must
+ * already leave the chain out, so kept text is weighed against what
+ * remains. */
+static void release_history_nodes(History* history, HistoryNode* first, HistoryNode* last) {
+    for (HistoryNode* node = first;; node = node->next) {
+        release_node_text(history, node);
+        for (HistoryNode* child = node->first_child; child; child = child->next) {
+            release_node_text(history, child);
+            if (child == node->last_child) break;
+        }
+        if (node == last) break;
+    }
+    
+    last->next = history->free_nodes;
+    history->free_nodes = first;
+}
+
+static int set_node_text(HistoryNode* node, const char* text, size_t length) {
+    if (node->capacity < length) {
+        char* grown = (char*)realloc(node->text, length);
+        if (!grown) {
+            perror("Failed to allocate memory for history text");
+            return -1;
+        }
+        node->text = grown;
+        node->capacity = length;
+    }
+    memcpy(node->text, text, length);
+    node->length = length;
+    return 0;
+}
+
+/* Single-byte nodes keep their byte in character and never touch text. */
+static const char* node_span(HistoryNode* node) {
+    return node->length > 1 ? node->text : &node->character;
+}
+
+/* Adds one byte to either end of a node's span, growing text geometrically. */
+static int extend_node_span(HistoryNode* node, char ch, int at_front) {
+    size_t length = node->length + 1;
+    
+    if (node->capacity < length) {
+        size_t new_capacity = node->capacity * 2 > 16 ? node->capacity * 2 : 16;
+        char* grown = (char*)realloc(node->text, new_capacity);
+        if (!grown) {
+            perror("Failed to allocate memory for history text");
+            return -1;
+        }
+        node->text = grown;
+        node->capacity = new_capacity;
+    }
+    
+    if (node->length == 1) {
+        node->text[0] = node->character;
+    }
+    
+    if (at_front) {
+        memmove(node->text + 1, node->text, node->length);
+        node->text[0] = ch;
+    } else {
+        node->text[node->length] = ch;
+    }
+    node->length = length;
+    return 0;
+}
+
+static unsigned long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ull + (unsigned long long)ts.tv_nsec / 1000000ull;
+}
+
+static int starts_new_word(char previous, char next) {
+    return isspace((unsigned char)previous) && !isspace((unsigned char)next);
+}
+
+static size_t node_footprint(HistoryNode* node) {
+    return sizeof(HistoryNode) + node->capacity;
+}
+
+/* Live bytes follow from the running totals, so dropping a whole redo
+ * branch needs no walk. */
+static void update_history_bytes(History* history) {
+    if (!history->head) {
+        history->bytes = 0;
+        return;
+    }
+    history->bytes = history->tail->bytes_through - history->head->bytes_through + history->head->bytes;
+}
+
+/* Drops the oldest steps until the history fits its budget (0 means
+ * unbounded) and recounts the steps kept. */
+static void enforce_history_budget(History* history) {
+    while (history->max_bytes > 0 && history->bytes + history->spare_bytes > history->max_bytes &&
+           history->head != history->tail) {
+        HistoryNode* old_head = history->head;
+        history->head = old_head->next;
+        history->head->prev = NULL;
+        history->bytes -= old_head->bytes;
+        release_history_nodes(history, old_head, old_head);
+    }
+    
+    history->count = (int)(history->tail->serial - history->head->serial + 1);
+}
+
+/* Re-charges the newest step after its span or batch changed size. */
+static void set_tail_bytes(History* history, size_t bytes) {
+    HistoryNode* tail = history->tail;
+    tail->bytes_through = tail->bytes_through - tail->bytes + bytes;
+    history->bytes = history->bytes - tail->bytes + bytes;
+    tail->bytes = bytes;
+    enforce_history_budget(history);
+}
+
+/* Tries to fold a one-byte edit into the newest node. Only the tail can
+ * grow, and only while it is the same kind of edit, directly adjacent to
+ * the new byte, recent, and not about to cross into a new word. Inside a
+ * batch the whole batch is one step anyway, so any adjacent edit merges
+ * into the batch's last child. */
+static int merge_into_span(History* history, EditType type, size_t position, char character, unsigned long long now) {
+    HistoryNode* node;
+    int in_batch = history->batch_depth > 0;
+    
+    if (in_batch) {
+        node = history->open_batch ? history->open_batch->last_child : NULL;
+    } else {
+        node = history->current == history->tail ? history->current : NULL;
+        if (!history->span_open || now - history->last_record_ms > HISTORY_MERGE_IDLE_MS) {
+            return 0;
+        }
+    }
+    
+    if (!node || node->type != type) {
+        return 0;
+    }
+    
+    const char* span = node_span(node);
+    int at_front;
+    
+    if (type == INSERT_CHAR && position == node->position + node->length) {
+        if (!in_batch && starts_new_word(span[node->length - 1], character)) return 0;
+        at_front = 0;
+    } else if (type == DELETE_CHAR && position == node->position) {
+        if (!in_batch && starts_new_word(span[node->length - 1], character)) return 0;
+        at_front = 0;
+    } else if (type == DELETE_CHAR && position + 1 == node->position) {
+        if (!in_batch && starts_new_word(character, span[0])) return 0;
+        at_front = 1;
+    } else {
+        return 0;
+    }
+    
+    size_t capacity = node->capacity;
+    if (extend_node_span(node, character, at_front) < 0) return 0;
+    if (at_front) {
+        node->position = position;
+    }
+    if (node->capacity != capacity) {
+        set_tail_bytes(history, history->tail->bytes + (node->capacity - capacity));
+    }
+    return 1;
+}
+
 static void add_history_node(History* history, HistoryNode* node) {
     if (!history || !node) return;
     
-    if (history->current && history->current != history->tail) {
-        HistoryNode* after_current = history->current->next;
-        history->current->next = NULL;
+    if (history->current != history->tail) {
+        HistoryNode* after_current = history->current ? history->current->next : history->head;
+        HistoryNode* dropped_tail = history->tail;
         
-        HistoryNode* temp = after_current;
-        while (temp) {
-            HistoryNode* next = temp->next;
-            free(temp);
-            temp = next;
-            history->count--;
+        if (history->current) {
+            history->current->next = NULL;
+        } else {
+            history->head = NULL;
         }
-        
         history->tail = history->current;
+        update_history_bytes(history);
+        release_history_nodes(history, after_current, dropped_tail);
     }
     
+    node->serial = history->next_serial++;
+    node->bytes = node_footprint(node);
+    node->bytes_through = (history->tail ? history->tail->bytes_through : 0) + node->bytes;
+    
     if (!history->head) {
         history->head = node;
         history->tail = node;
@@ -66,119 +292,209 @@ static void add_history_node(History* history, HistoryNode* node) {
     }
     
     history->current = node;
-    history->count++;
     
-    if (history->max_history > 0 && history->count > history->max_history) {
-        HistoryNode* old_head = history->head;
-        history->head = old_head->next;
-        if (history->head) {
-            history->head->prev = NULL;
+    update_history_bytes(history);
+    enforce_history_budget(history);
+}
+
+/* Links a freshly filled node into the history, or into the open batch
+ * when one is active. The batch node itself enters the history on its
+ * first edit, so an empty batch leaves no trace. */
+static void attach_node(History* history, HistoryNode* node) {
+    if (history->batch_depth == 0) {
+        add_history_node(history, node);
+        return;
+    }
+    
+    HistoryNode* batch = history->open_batch;
+    if (!batch) {
+        batch = alloc_history_node(history);
+        if (!batch) {
+            release_history_nodes(history, node, node);
+            return;
         }
-        free(old_head);
-        history->count--;
+        batch->type = BATCH_EDIT;
+        batch->position = node->position;
+        batch->length = 0;
+        add_history_node(history, batch);
+        history->open_batch = batch;
+    }
+    
+    node->next = NULL;
+    node->prev = batch->last_child;
+    if (batch->last_child) {
+        batch->last_child->next = node;
+    } else {
+        batch->first_child = node;
     }
+    batch->last_child = node;
+    batch->length++;
+    set_tail_bytes(history, batch->bytes + node_footprint(node));
 }
 
-void record_insert(History* history, size_t position, char character, size_t x, size_t y) {
-    if (!history || history->batch_mode) return;
+/* A batch holding a single edit is stored as that edit. The child's
+ * contents move into the batch node, which keeps its place in the list. */
+static void collapse_batch(History* history, HistoryNode* batch) {
+    HistoryNode* child = batch->first_child;
+    if (!child || child != batch->last_child) return;
     
-    HistoryNode* node = (HistoryNode*)malloc(sizeof(HistoryNode));
-    if (!node) {
-        perror("Failed to allocate memory for history node");
-        return;
-    }
+    char* text = batch->text;
+    size_t capacity = batch->capacity;
     
-    node->type = INSERT_CHAR;
-    node->position = position;
-    node->character = character;
-    node->screen_x = x;
-    node->screen_y = y;
+    batch->type = child->type;
+    batch->position = child->position;
+    batch->character = child->character;
+    batch->length = child->length;
+    batch->text = child->text;
+    batch->capacity = child->capacity;
+    batch->first_child = NULL;
+    batch->last_child = NULL;
     
-    add_history_node(history, node);
+    child->text = text;
+    child->capacity = capacity;
+    child->next = NULL;
+    release_history_nodes(history, child, child);
+    
+    if (batch == history->tail) {
+        set_tail_bytes(history, node_footprint(batch));
+    }
 }
 
-void record_delete(History* history, size_t position, char character, size_t x, size_t y) {
-    if (!history || history->batch_mode) return;
+static void record_char(History* history, EditType type, size_t position, char character) {
+    unsigned long long now = monotonic_ms();
     
-    HistoryNode* node = (HistoryNode*)malloc(sizeof(HistoryNode));
-    if (!node) {
-        perror("Failed to allocate memory for history node");
+    if (type != ENTER_LINE && merge_into_span(history, type, position, character, now)) {
+        history->last_record_ms = now;
         return;
     }
     
-    node->type = DELETE_CHAR;
+    HistoryNode* node = alloc_history_node(history);
+    if (!node) return;
+    
+    node->type = type;
     node->position = position;
     node->character = character;
-    node->screen_x = x;
-    node->screen_y = y;
     
-    add_history_node(history, node);
+    attach_node(history, node);
+    
+    history->span_open = type != ENTER_LINE;
+    history->last_record_ms = now;
 }
 
-void record_enter(History* history, size_t position, size_t x, size_t y) {
+void record_insert(History* history, size_t position, char character) {
     if (!history) return;
+    record_char(history, INSERT_CHAR, position, character);
+}
+
+void record_delete(History* history, size_t position, char character) {
+    if (!history) return;
+    record_char(history, DELETE_CHAR, position, character);
+}
+
+void record_enter(History* history, size_t position) {
+    if (!history) return;
+    record_char(history, ENTER_LINE, position, '\n');
+}
+
+void record_insert_text(History* history, size_t position, const char* text, size_t length) {
+    if (!history || length == 0) return;
+    if (length == 1) {
+        record_insert(history, position, text[0]);
+        return;
+    }
     
-    HistoryNode* node = (HistoryNode*)malloc(sizeof(HistoryNode));
-    if (!node) {
-        perror("Failed to allocate memory for history node");
+    HistoryNode* node = alloc_history_node(history);
+    if (!node) return;
+    
+    if (set_node_text(node, text, length) < 0) {
+        release_history_nodes(history, node, node);
         return;
     }
     
-    node->type = ENTER_LINE;
+    node->type = INSERT_CHAR;
     node->position = position;
-    node->character = '\n';
-    node->screen_x = x;
-    node->screen_y = y;
+    node->character = text[0];
     
-    add_history_node(history, node);
+    attach_node(history, node);
+    history->span_open = 0;
 }
 
-void start_batch(History* history) {
+void close_history_span(History* history) {
     if (!history) return;
-    history->batch_mode = 1;
+    history->span_open = 0;
 }
 
-void end_batch(History* history) {
+void start_batch(History* history) {
     if (!history) return;
-    history->batch_mode = 0;
+    history->batch_depth++;
 }
 
-int undo(History* history, Buffer* buf, size_t* x, size_t* y, size_t width) {
-    if (!history || !history->current) return 0;
-    
-    HistoryNode* node = history->current;
+void end_batch(History* history) {
+    if (!history || history->batch_depth == 0) return;
+    if (--history->batch_depth > 0) return;
     
+    if (history->open_batch) {
+        collapse_batch(history, history->open_batch);
+        history->open_batch = NULL;
+    }
+    history->span_open = 0;
+}
+
+static void undo_node(History* history, HistoryNode* node, Buffer* buf) {
     switch (node->type) {
         case INSERT_CHAR:
-            move_buffer_cursor(buf, node->position + 1);
-            delete_buffer(buf);
+        case ENTER_LINE:
+            delete_range(buf, node->position, node->length);
             break;
             
         case DELETE_CHAR:
-            move_buffer_cursor(buf, node->position);
-            insert_buffer(buf, node->character);
+            insert_string(buf, node->position, node_span(node), node->length);
             break;
             
-        case ENTER_LINE:
-            move_buffer_cursor(buf, node->position);
-            for (size_t i = 0; i < width - 2; i++) {
-                delete_buffer(buf);
+        case BATCH_EDIT:
+            for (HistoryNode* child = node->last_child; child; child = child->prev) {
+                undo_node(history, child, buf);
             }
             break;
+    }
+}
+
+static void redo_node(History* history, HistoryNode* node, Buffer* buf) {
+    switch (node->type) {
+        case INSERT_CHAR:
+        case ENTER_LINE:
+            insert_string(buf, node->position, node_span(node), node->length);
+            break;
+            
+        case DELETE_CHAR:
+            delete_range(buf, node->position, node->length);
+            break;
             
         case BATCH_EDIT:
+            for (HistoryNode* child = node->first_child; child; child = child->next) {
+                redo_node(history, child, buf);
+            }
             break;
     }
+}
+
+int undo(History* history, Buffer* buf, size_t* position) {
+    if (!history || !history->current) return 0;
+    
+    HistoryNode* node = history->current;
+    history->span_open = 0;
+    history->open_batch = NULL;
+    
+    undo_node(history, node, buf);
     
     history->current = node->prev;
     
-    *x = node->screen_x;
-    *y = node->screen_y;
+    *position = buffer_cursor(buf);
     
     return 1;
 }
 
-int redo(History* history, Buffer* buf, size_t* x, size_t* y, size_t width) {
+int redo(History* history, Buffer* buf, size_t* position) {
     if (!history) return 0;
     
     if (history->current == NULL && history->head != NULL) {
@@ -192,31 +508,12 @@ int redo(History* history, Buffer* buf, size_t* x, size_t* y, size_t width) {
     }
     
     HistoryNode* node = history->current;
+    history->span_open = 0;
+    history->open_batch = NULL;
     
-    switch (node->type) {
-        case INSERT_CHAR:
-            move_buffer_cursor(buf, node->position);
-            insert_buffer(buf, node->character);
-            break;
-            
-        case DELETE_CHAR:
-            move_buffer_cursor(buf, node->position + 1);
-            delete_buffer(buf);
-            break;
-            
-        case ENTER_LINE:
-            move_buffer_cursor(buf, node->position);
-            for (size_t i = 0; i < width - 2; i++) {
-                insert_buffer(buf, ' ');
-            }
-            break;
-            
-        case BATCH_EDIT:
-            break;
-    }
+    redo_node(history, node, buf);
     
-    *x = node->screen_x;
-    *y = node->screen_y;
+    *position = buffer_cursor(buf);
     
     return 1;
 }
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "indexer.h"
+#include "scan.h"
+
+/* Workers walk their chunk in steps of this size, checking for a stop
+ * request and dropping mapped pages behind them. */
+#define INDEX_STEP (8 * 1024 * 1024)
+/* A sparse scan counts newlines a block at a time and only looks for
+ * individual ones in blocks holding a line it keeps. */
+#define SPARSE_SKIP_BLOCK 4096
+
+typedef enum {
+    CHUNK_COUNT,
+    CHUNK_FILL,
+    CHUNK_SPARSE
+} ChunkTask;
+
+typedef struct {
+    ChunkTask task;
+    const char* text;
+    size_t from;
+    size_t to;
+    IndexJob* job;
+    int stats;
+    size_t newlines;
+    size_t words;
+    size_t non_blank;
+    size_t base;
+    size_t* out;
+    size_t line;
+    size_t stride;
+} IndexChunk;
+
+static size_t thread_cap = 0;
+
+size_t index_use_threads(size_t threads) {
+    size_t previous = thread_cap;
+    thread_cap = threads;
+    return previous;
+}
+
+static int job_stopped(IndexJob* job) {
+    if (!job) return 0;
+
+    pthread_mutex_lock(&job->lock);
+    int stop = job->stop;
+    pthread_mutex_unlock(&job->lock);
+    return stop;
+}
+
+static void drop_pages(const char* text, size_t length) {
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)text + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t last = (uintptr_t)(text + length) & ~(uintptr_t)(page - 1);
+    if (last > first) {
+        madvise((void*)first, last - first, MADV_DONTNEED);
+    }
+}
+
+/* Records the start of each line in [from, from + length) whose number is
+ * a multiple of the stride; chunk->line is the line the next newline
+ * starts. */
+static void mark_sparse_lines(IndexChunk* chunk, size_t from, size_t length) {
+    size_t end = from + length;
+    while (from < end) {
+        size_t block = end - from < SPARSE_SKIP_BLOCK ? end - from : SPARSE_SKIP_BLOCK;
+        size_t skip = (chunk->stride - chunk->line % chunk->stride) % chunk->stride;
+        size_t newlines = scan_count_newlines(chunk->text + from, block);
+
+        if (newlines <= skip) {
+            chunk->line += newlines;
+        } else {
+            const char* p = chunk->text + from;
+            const char* stop = p + block;
+            while (p < stop && (p = (const char*)memchr(p, '\n', (size_t)(stop - p))) != NULL) {
+                p++;
+                if (chunk->line % chunk->stride == 0) {
+                    chunk->out[chunk->line / chunk->stride] = (size_t)(p - chunk->text);
+                }
+                chunk->line++;
+            }
+        }
+        from += block;
+    }
+}
+
+static void* run_chunk(void* arg) {
+    IndexChunk* chunk = (IndexChunk*)arg;
+    size_t found = 0;
+
+    for (size_t from = chunk->from; from < chunk->to; from += INDEX_STEP) {
+        if (job_stopped(chunk->job)) break;
+
+        size_t length = chunk->to - from < INDEX_STEP ? chunk->to - from : INDEX_STEP;
+        const char* text = chunk->text + from;
+        switch (chunk->task) {
+            case CHUNK_COUNT:
+                chunk->newlines += scan_count_newlines(text, length);
+                if (chunk->stats) {
+                    /* The byte before the step says whether it starts mid-word. */
+                    int in_word = from > 0 && !isspace((unsigned char)text[-1]);
+                    chunk->words += scan_count_word_starts(text, length, in_word);
+                    chunk->non_blank += scan_count_non_blank(text, length);
+                }
+                break;
+            case CHUNK_FILL:
+                found += scan_newline_positions(text, length, chunk->base + from, chunk->out + found);
+                break;
+            case CHUNK_SPARSE:
+                mark_sparse_lines(chunk, from, length);
+                break;
+        }
+
+        /* Counting is always followed by a fill or sparse pass over the
+         * same step, so its pages are only dropped after that one. */
+        if (chunk->job && chunk->task != CHUNK_COUNT) {
+            drop_pages(text, length);
+        }
+    }
+    return NULL;
+}
+
+/* Splits text into one chunk per worker, each at least INDEX_MIN_CHUNK. */
+static size_t split_chunks(IndexChunk* chunks, const char* text, size_t length, IndexJob* job, int stats) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t count = length / INDEX_MIN_CHUNK;
+    if (cores > 0 && count > (size_t)cores) {
+        count = (size_t)cores;
+    }
+    if (thread_cap > 0 && count > thread_cap) {
+        count = thread_cap;
+    }
+    if (count > INDEX_MAX_THREADS) {
+        count = INDEX_MAX_THREADS;
+    }
+    if (count == 0) {
+        count = 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        memset(&chunks[i], 0, sizeof(IndexChunk));
+        chunks[i].task = CHUNK_COUNT;
+        chunks[i].text = text;
+        chunks[i].from = length / count * i;
+        chunks[i].to = i + 1 == count ? length : length / count * (i + 1);
+        chunks[i].job = job;
+        chunks[i].stats = stats;
+    }
+    return count;
+}
+
+/* Runs the first chunk on the calling thread and the rest on workers; a
+ * worker that cannot be started has its chunk run inline instead. */
+static void run_chunks(IndexChunk* chunks, size_t count) {
+    pthread_t threads[INDEX_MAX_THREADS];
+    int started[INDEX_MAX_THREADS];
+
+    for (size_t i = 1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, run_chunk, &chunks[i]) == 0;
+    }
+    run_chunk(&chunks[0]);
+    for (size_t i = 1; i < count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            run_chunk(&chunks[i]);
+        }
+    }
+}
+
+static size_t* build_newlines(const char* text, size_t length, size_t base, size_t front, IndexJob* job,
+                              size_t* count, size_t* words, size_t* non_blank) {
+    IndexChunk chunks[INDEX_MAX_THREADS];
+    size_t chunk_count = split_chunks(chunks, text, length, job, words != NULL);
+    run_chunks(chunks, chunk_count);
+    if (job_stopped(job)) return NULL;
+
+    size_t total = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        total += chunks[i].newlines;
+        if (words) {
+            *words += chunks[i].words;
+            *non_blank += chunks[i].non_blank;
+        }
+    }
+
+    size_t* out = (size_t*)malloc((front + total ? front + total : 1) * sizeof(size_t));
+    if (!out) {
+        perror("Failed to allocate line index");
+        return NULL;
+    }
+
+    /* Each chunk's newlines go straight after those of the chunks before it. */
+    size_t offset = front;
+    for (size_t i = 0; i < chunk_count; i++) {
+        chunks[i].task = CHUNK_FILL;
+        chunks[i].base = base;
+        chunks[i].out = out + offset;
+        offset += chunks[i].newlines;
+    }
+    run_chunks(chunks, chunk_count);
+    if (job_stopped(job)) {
+        free(out);
+        return NULL;
+    }
+
+    *count = total;
+    return out;
+}
+
+static size_t* build_sparse_lines(const char* text, size_t length, size_t stride, IndexJob* job,
+                                  size_t* count, size_t* lines) {
+    IndexChunk chunks[INDEX_MAX_THREADS];
+    size_t chunk_count = split_chunks(chunks, text, length, job, 0);
+    run_chunks(chunks, chunk_count);
+    if (job_stopped(job)) return NULL;
+
+    size_t total = 1;
+    for (size_t i = 0; i < chunk_count; i++) {
+        total += chunks[i].newlines;
+    }
+
+    size_t slots = (total - 1) / stride + 1;
+    size_t* out = (size_t*)malloc(slots * sizeof(size_t));
+    if (!out) {
+        perror("Failed to allocate sparse line index");
+        return NULL;
+    }
+    out[0] = 0;
+
+    size_t line = 1;
+    for (size_t i = 0; i < chunk_count; i++) {
+        chunks[i].task = CHUNK_SPARSE;
+        chunks[i].out = out;
+        chunks[i].stride = stride;
+        chunks[i].line = line;
+        line += chunks[i].newlines;
+    }
+    run_chunks(chunks, chunk_count);
+    if (job_stopped(job)) {
+        free(out);
+        return NULL;
+    }
+
+    *count = slots;
+    *lines = total;
+    return out;
+}
+
+size_t* index_newlines(const char* text, size_t length, size_t base, size_t front, size_t* count,
+                       size_t* words, size_t* non_blank) {
+    scan_level();
+    if (words) {
+        *words = 0;
+        *non_blank = 0;
+    }
+    return build_newlines(text, length, base, front, NULL, count, words, non_blank);
+}
+
+static void* run_index_job(void* arg) {
+    IndexJob* job = (IndexJob*)arg;
+    size_t count = 0;
+    size_t lines = 0;
+    size_t words = 0;
+    size_t non_blank = 0;
+    size_t* starts;
+
+    if (job->stride) {
+        starts = build_sparse_lines(job->text, job->length, job->stride, job, &count, &lines);
+    } else {
+        starts = build_newlines(job->text, job->length, 0, 0, job, &count, &words, &non_blank);
+        lines = count + 1;
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->starts = starts;
+    job->count = count;
+    job->lines = lines;
+    job->words = words;
+    job->non_blank = non_blank;
+    job->done = 1;
+    pthread_cond_broadcast(&job->finished);
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+IndexJob* start_index_job(const char* text, size_t length, size_t stride) {
+    IndexJob* job = (IndexJob*)calloc(1, sizeof(IndexJob));
+    if (!job) {
+        perror("Failed to allocate memory for index job");
+        return NULL;
+    }
+
+    job->text = text;
+    job->length = length;
+    job->stride = stride;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->finished, NULL);
+
+    /* Pick the scan kernels here so workers never race to do it. */
+    scan_level();
+    if (pthread_create(&job->thread, NULL, run_index_job, job) != 0) {
+        perror("Error starting index thread");
+        pthread_mutex_destroy(&job->lock);
+        pthread_cond_destroy(&job->finished);
+        free(job);
+        return NULL;
+    }
+
+    return job;
+}
+
+int index_job_done(IndexJob* job) {
+    pthread_mutex_lock(&job->lock);
+    int done = job->done;
+    pthread_mutex_unlock(&job->lock);
+    return done;
+}
+
+void wait_index_job(IndexJob* job) {
+    pthread_mutex_lock(&job->lock);
+    while (!job->done) {
+        pthread_cond_wait(&job->finished, &job->lock);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+void free_index_job(IndexJob* job) {
+    if (!job) return;
+
+    pthread_mutex_lock(&job->lock);
+    job->stop = 1;
+    pthread_mutex_unlock(&job->lock);
+    pthread_join(job->thread, NULL);
+
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->finished);
+    free(job->starts);
+    free(job);
+}
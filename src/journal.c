@@ -0,0 +1,523 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "journal.h"
+
+#define JOURNAL_MAGIC "TXJ1"
+#define JOURNAL_HEADER_SIZE 28
+#define JOURNAL_RECORD_SIZE 17
+#define JOURNAL_NO_RECORD ((size_t)-1)
+
+#define OP_INSERT 'I'
+#define OP_DELETE 'D'
+
+/* Header: magic, then size, mtime seconds and mtime nanoseconds of the file
+ * the edits apply to. Records: an op byte, position and length as native
+ * 64-bit integers, then the inserted bytes for inserts. */
+
+static void journal_path(const char* filename, char* path, size_t size) {
+    const char* slash = strrchr(filename, '/');
+    if (slash) {
+        snprintf(path, size, "%.*s.%s.journal", (int)(slash - filename + 1), filename, slash + 1);
+    } else {
+        snprintf(path, size, ".%s.journal", filename);
+    }
+}
+
+static int write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            errno = EIO;
+            return -1;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+    return 0;
+}
+
+static void encode_header(char* header, const struct stat* st) {
+    uint64_t size = (uint64_t)st->st_size;
+    int64_t seconds = (int64_t)st->st_mtim.tv_sec;
+    int64_t nanoseconds = (int64_t)st->st_mtim.tv_nsec;
+
+    memcpy(header, JOURNAL_MAGIC, 4);
+    memcpy(header + 4, &size, 8);
+    memcpy(header + 12, &seconds, 8);
+    memcpy(header + 20, &nanoseconds, 8);
+}
+
+static int write_header(int fd, const char* filename) {
+    struct stat st;
+    char header[JOURNAL_HEADER_SIZE];
+
+    if (stat(filename, &st) < 0) {
+        return -1;
+    }
+    encode_header(header, &st);
+
+    if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        return -1;
+    }
+    if (write_all(fd, header, sizeof(header)) < 0) {
+        return -1;
+    }
+    return fdatasync(fd);
+}
+
+int lock_journal(const char* filename) {
+    char path[4096];
+    journal_path(filename, path, sizeof(path));
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        perror("Error opening journal");
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        int busy = errno == EWOULDBLOCK;
+        if (!busy) {
+            perror("Error locking journal");
+        }
+        close(fd);
+        return busy ? JOURNAL_BUSY : -1;
+    }
+    return fd;
+}
+
+/* Copies a journal that no longer matches its file to
+ * ".<name>.journal.stale" (or .stale.1, .stale.2, ... if taken). */
+static int keep_stale_journal(const char* path, const char* data, size_t length, char* stale_path, size_t size) {
+    for (int attempt = 0; attempt < 100; attempt++) {
+        if (attempt == 0) {
+            snprintf(stale_path, size, "%s.stale", path);
+        } else {
+            snprintf(stale_path, size, "%s.stale.%d", path, attempt);
+        }
+
+        int fd = open(stale_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            if (errno == EEXIST) continue;
+            break;
+        }
+        if (write_all(fd, data, length) < 0 || fsync(fd) < 0) {
+            close(fd);
+            unlink(stale_path);
+            break;
+        }
+        close(fd);
+        return 0;
+    }
+
+    perror("Error keeping stale journal");
+    stale_path[0] = '\0';
+    return -1;
+}
+
+void replay_journal(int fd, const char* filename, Buffer* buf, JournalRecovery* recovery) {
+    char path[4096];
+    struct stat file_st, journal_st;
+
+    recovery->replayed = 0;
+    recovery->end = 0;
+    recovery->stale = 0;
+    recovery->stale_path[0] = '\0';
+    journal_path(filename, path, sizeof(path));
+
+    if (fstat(fd, &journal_st) < 0 || stat(filename, &file_st) < 0 ||
+        journal_st.st_size <= JOURNAL_HEADER_SIZE) {
+        return;
+    }
+
+    size_t size = (size_t)journal_st.st_size;
+    char* data = (char*)malloc(size);
+    if (!data) {
+        perror("Failed to allocate memory for journal");
+        recovery->stale = -1;
+        return;
+    }
+
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = pread(fd, data + total, size - total, (off_t)total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        total += (size_t)n;
+    }
+
+    char expected[JOURNAL_HEADER_SIZE];
+    encode_header(expected, &file_st);
+    if (total < JOURNAL_HEADER_SIZE || memcmp(data, expected, JOURNAL_HEADER_SIZE) != 0) {
+        recovery->stale = keep_stale_journal(path, data, total, recovery->stale_path,
+                                             sizeof(recovery->stale_path)) == 0 ? 1 : -1;
+        free(data);
+        return;
+    }
+
+    /* A crash can leave a torn record at the end; replay stops there, as
+     * it does at anything that does not fit the buffer. */
+    size_t replayed = 0;
+    size_t offset = JOURNAL_HEADER_SIZE;
+    size_t good = offset;
+    while (offset + JOURNAL_RECORD_SIZE <= total) {
+        char op = data[offset];
+        uint64_t position, length;
+        memcpy(&position, data + offset + 1, 8);
+        memcpy(&length, data + offset + 9, 8);
+        offset += JOURNAL_RECORD_SIZE;
+
+        if (op == OP_INSERT) {
+            if (length > total - offset || position > buf->text_size) break;
+            insert_string(buf, (size_t)position, data + offset, (size_t)length);
+            offset += (size_t)length;
+        } else if (op == OP_DELETE) {
+            if (position > buf->text_size || length > buf->text_size - position) break;
+            delete_range(buf, (size_t)position, (size_t)length);
+        } else {
+            break;
+        }
+        replayed++;
+        good = offset;
+    }
+
+    free(data);
+    recovery->replayed = replayed;
+    recovery->end = (off_t)good;
+}
+
+static void* journal_writer(void* arg) {
+    Journal* journal = (Journal*)arg;
+
+    pthread_mutex_lock(&journal->lock);
+    for (;;) {
+        while (journal->pending_length == 0 && !journal->stop) {
+            pthread_cond_wait(&journal->wake, &journal->lock);
+        }
+        if (journal->pending_length == 0) {
+            break;
+        }
+
+        /* Give the edits that follow a chance to join this write. */
+        if (!journal->stop && journal->pending_length < JOURNAL_WAKE_BYTES) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += JOURNAL_SYNC_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&journal->wake, &journal->lock, &deadline);
+        }
+
+        char* data = journal->pending;
+        size_t length = journal->pending_length;
+        size_t capacity = journal->pending_capacity;
+
+        journal->pending = journal->writing;
+        journal->pending_capacity = journal->writing_capacity;
+        journal->pending_length = 0;
+        journal->last_record = JOURNAL_NO_RECORD;
+        journal->writing = data;
+        journal->writing_capacity = capacity;
+
+        /* io_lock is taken before lock is dropped, so a checkpoint that
+         * holds both never sees a batch that was dequeued but not written. */
+        pthread_mutex_lock(&journal->io_lock);
+        pthread_mutex_unlock(&journal->lock);
+
+        if (write_all(journal->fd, data, length) < 0 || fdatasync(journal->fd) < 0) {
+            perror("Error writing journal");
+        }
+        pthread_mutex_unlock(&journal->io_lock);
+
+        pthread_mutex_lock(&journal->lock);
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    return NULL;
+}
+
+/* Drops whatever follows the last good record, so new records are never
+ * appended behind a torn one that would stop the next recovery short. */
+static int keep_records(int fd, off_t keep_length) {
+    if (ftruncate(fd, keep_length) < 0 || lseek(fd, keep_length, SEEK_SET) < 0) {
+        return -1;
+    }
+    return fdatasync(fd);
+}
+
+Journal* open_journal(int fd, const char* filename, off_t keep_length) {
+    if (fd < 0) return NULL;
+
+    Journal* journal = (Journal*)calloc(1, sizeof(Journal));
+    if (!journal) {
+        perror("Failed to allocate memory for journal");
+        close(fd);
+        return NULL;
+    }
+
+    journal_path(filename, journal->path, sizeof(journal->path));
+    journal->fd = fd;
+
+    int positioned = keep_length > 0 ? keep_records(journal->fd, keep_length)
+                                     : write_header(journal->fd, filename);
+    if (positioned < 0) {
+        perror("Error preparing journal");
+        close(journal->fd);
+        free(journal);
+        return NULL;
+    }
+
+    journal->last_record = JOURNAL_NO_RECORD;
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_mutex_init(&journal->io_lock, NULL);
+    pthread_cond_init(&journal->wake, NULL);
+
+    if (pthread_create(&journal->writer, NULL, journal_writer, journal) != 0) {
+        perror("Error starting journal writer");
+        close(journal->fd);
+        pthread_mutex_destroy(&journal->lock);
+        pthread_mutex_destroy(&journal->io_lock);
+        pthread_cond_destroy(&journal->wake);
+        free(journal);
+        return NULL;
+    }
+
+    return journal;
+}
+
+static int reserve_pending(Journal* journal, size_t extra) {
+    size_t needed = journal->pending_length + extra;
+    if (needed <= journal->pending_capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = journal->pending_capacity ? journal->pending_capacity * 2 : 4096;
+    if (new_capacity < needed) {
+        new_capacity = needed;
+    }
+    char* grown = (char*)realloc(journal->pending, new_capacity);
+    if (!grown) {
+        perror("Failed to grow journal queue");
+        return -1;
+    }
+    journal->pending = grown;
+    journal->pending_capacity = new_capacity;
+    return 0;
+}
+
+static void read_record(Journal* journal, char* op, uint64_t* position, uint64_t* length) {
+    const char* record = journal->pending + journal->last_record;
+    *op = record[0];
+    memcpy(position, record + 1, 8);
+    memcpy(length, record + 9, 8);
+}
+
+/* Folds an edit into the newest queued record when it continues it:
+ * typing grows an insert, Backspace and Delete runs grow a delete. */
+static int extend_last_record(Journal* journal, char op, size_t position, const char* text, size_t length) {
+    char last_op;
+    uint64_t last_position, last_length;
+
+    if (journal->last_record == JOURNAL_NO_RECORD) {
+        return 0;
+    }
+    read_record(journal, &last_op, &last_position, &last_length);
+
+    /* Backspacing over text typed since the last flush just takes it back
+     * out of the queued insert. */
+    if (last_op == OP_INSERT && op == OP_DELETE &&
+        position + length == last_position + last_length && length <= last_length) {
+        journal->pending_length -= length;
+        last_length -= length;
+        if (last_length == 0) {
+            journal->pending_length = journal->last_record;
+            journal->last_record = JOURNAL_NO_RECORD;
+        } else {
+            memcpy(journal->pending + journal->last_record + 9, &last_length, 8);
+        }
+        return 1;
+    }
+
+    if (last_op != op) {
+        return 0;
+    }
+
+    if (op == OP_INSERT) {
+        if (position != last_position + last_length || reserve_pending(journal, length) < 0) {
+            return 0;
+        }
+        memcpy(journal->pending + journal->pending_length, text, length);
+        journal->pending_length += length;
+    } else if (position == last_position) {
+        /* Forward delete: the span keeps its start. */
+    } else if (position + length == last_position) {
+        last_position = position;
+    } else {
+        return 0;
+    }
+
+    last_length += length;
+    char* record = journal->pending + journal->last_record;
+    memcpy(record + 1, &last_position, 8);
+    memcpy(record + 9, &last_length, 8);
+    return 1;
+}
+
+static void queue_record(Journal* journal, char op, size_t position, const char* text, size_t length) {
+    pthread_mutex_lock(&journal->lock);
+
+    size_t queued_before = journal->pending_length;
+
+    if (!extend_last_record(journal, op, position, text, length)) {
+        size_t payload = op == OP_INSERT ? length : 0;
+        if (reserve_pending(journal, JOURNAL_RECORD_SIZE + payload) == 0) {
+            uint64_t encoded_position = position;
+            uint64_t encoded_length = length;
+            char* record = journal->pending + journal->pending_length;
+
+            record[0] = op;
+            memcpy(record + 1, &encoded_position, 8);
+            memcpy(record + 9, &encoded_length, 8);
+            if (payload > 0) {
+                memcpy(record + JOURNAL_RECORD_SIZE, text, payload);
+            }
+
+            journal->last_record = journal->pending_length;
+            journal->pending_length += JOURNAL_RECORD_SIZE + payload;
+        }
+    }
+
+    if (queued_before == 0 ||
+        (queued_before < JOURNAL_WAKE_BYTES && journal->pending_length >= JOURNAL_WAKE_BYTES)) {
+        pthread_cond_signal(&journal->wake);
+    }
+
+    pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_insert(Journal* journal, size_t position, const char* text, size_t length) {
+    if (!journal || length == 0) return;
+    queue_record(journal, OP_INSERT, position, text, length);
+}
+
+void journal_delete(Journal* journal, size_t position, size_t length) {
+    if (!journal || length == 0) return;
+    queue_record(journal, OP_DELETE, position, NULL, length);
+}
+
+void journal_edit(void* context, size_t position, const char* text, size_t length) {
+    if (text) {
+        journal_insert((Journal*)context, position, text, length);
+    } else {
+        journal_delete((Journal*)context, position, length);
+    }
+}
+
+/* Writes out whatever is queued; the caller holds lock and io_lock. */
+static int flush_pending(Journal* journal) {
+    int status = write_all(journal->fd, journal->pending, journal->pending_length);
+    journal->pending_length = 0;
+    journal->last_record = JOURNAL_NO_RECORD;
+    return status;
+}
+
+void begin_journal_checkpoint(Journal* journal) {
+    if (!journal) return;
+
+    pthread_mutex_lock(&journal->lock);
+    pthread_mutex_lock(&journal->io_lock);
+
+    off_t offset = -1;
+    if (flush_pending(journal) == 0) {
+        offset = lseek(journal->fd, 0, SEEK_CUR);
+    }
+    if (offset < 0) {
+        perror("Error marking journal checkpoint");
+        journal->checkpointing = 0;
+    } else {
+        journal->checkpoint_offset = offset;
+        journal->checkpointing = 1;
+    }
+
+    pthread_mutex_unlock(&journal->io_lock);
+    pthread_mutex_unlock(&journal->lock);
+}
+
+void commit_journal_checkpoint(Journal* journal, const char* filename) {
+    if (!journal) return;
+
+    pthread_mutex_lock(&journal->lock);
+    pthread_mutex_lock(&journal->io_lock);
+
+    if (journal->checkpointing) {
+        journal->checkpointing = 0;
+
+        /* Keep the edits made after the snapshot, rebased onto the saved
+         * file; they are usually only what was typed during the write. */
+        char* carried = NULL;
+        ssize_t carried_length = 0;
+        off_t end = -1;
+
+        if (flush_pending(journal) == 0) {
+            end = lseek(journal->fd, 0, SEEK_CUR);
+        }
+        if (end >= journal->checkpoint_offset) {
+            carried_length = end - journal->checkpoint_offset;
+            carried = (char*)malloc(carried_length ? (size_t)carried_length : 1);
+        }
+        if (!carried ||
+            pread(journal->fd, carried, (size_t)carried_length, journal->checkpoint_offset) != carried_length ||
+            write_header(journal->fd, filename) < 0 ||
+            write_all(journal->fd, carried, (size_t)carried_length) < 0 ||
+            fdatasync(journal->fd) < 0) {
+            perror("Error compacting journal");
+        }
+        free(carried);
+    }
+
+    pthread_mutex_unlock(&journal->io_lock);
+    pthread_mutex_unlock(&journal->lock);
+}
+
+void cancel_journal_checkpoint(Journal* journal) {
+    if (!journal) return;
+
+    pthread_mutex_lock(&journal->lock);
+    journal->checkpointing = 0;
+    pthread_mutex_unlock(&journal->lock);
+}
+
+void close_journal(Journal* journal, int discard) {
+    if (!journal) return;
+
+    pthread_mutex_lock(&journal->lock);
+    journal->stop = 1;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->writer, NULL);
+
+    /* Unlinked while still locked, so no other editor can have taken it. */
+    if (discard) {
+        unlink(journal->path);
+    }
+    close(journal->fd);
+
+    pthread_mutex_destroy(&journal->lock);
+    pthread_mutex_destroy(&journal->io_lock);
+    pthread_cond_destroy(&journal->wake);
+    free(journal->pending);
+    free(journal->writing);
+    free(journal);
+}
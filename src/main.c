@@ -1,19 +1,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
 #include <ncurses.h>
 #include "buffer.h"
 #include "utils.h"
 #include "history.h"
+#include "journal.h"
+#include "saver.h"
 
 #define CTRL(c) ((c) & 037)
 #define LINE_NUMBER_WIDTH 4
 
-size_t get_buffer_position(size_t x_pos, size_t y_pos, size_t width, size_t first_character) {
-    size_t screen_index = (x_pos - 1) + y_pos * (width - 2);
-    return screen_index + first_character;
-}
-
 void display_status_message(const char* message) {
     int rows, cols;
     getmaxyx(stdscr, rows, cols);
@@ -36,10 +36,315 @@ void display_status_message(const char* message) {
     refresh();
 }
 
-int main(int argc __attribute__((unused)), char** argv) {
+#define KEY_PASTE_BEGIN (KEY_MAX + 1)
+#define KEY_PASTE_END (KEY_MAX + 2)
+
+static int is_text_key(int ch) {
+    return ch == '\n' || ch == '\r' || (ch >= 32 && ch <= 126);
+}
+
+static int is_edit_key(int ch) {
+    return is_text_key(ch) || ch == KEY_PASTE_BEGIN || ch == KEY_BACKSPACE || ch == BACKSPACE ||
+           ch == KEY_DC || ch == CTRL('z') || ch == CTRL('y') || ch == CTRL('s');
+}
+
+static int append_to_burst(char** burst, size_t* capacity, size_t* length, int ch) {
+    if (*length == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 256;
+        char* grown = (char*)realloc(*burst, new_capacity);
+        if (!grown) {
+            return -1;
+        }
+        *burst = grown;
+        *capacity = new_capacity;
+    }
+    (*burst)[(*length)++] = ch == '\r' ? '\n' : (char)ch;
+    return 0;
+}
+
+/* Collects ch plus every text key already waiting in the input queue, so a
+ * paste or fast typing burst becomes one edit and one frame. The first
+ * non-text key is pushed back for the main loop. */
+static size_t drain_typeahead(int ch, char** burst, size_t* capacity) {
+    size_t length = 0;
+
+    nodelay(stdscr, TRUE);
+    while (ch != ERR) {
+        if (!is_text_key(ch) || append_to_burst(burst, capacity, &length, ch) < 0) {
+            ungetch(ch);
+            break;
+        }
+        ch = getch();
+    }
+    nodelay(stdscr, FALSE);
+
+    return length;
+}
+
+/* Reads everything up to the terminal's paste-end marker. Pasted bytes are
+ * taken verbatim, apart from CR line endings which become '\n'. */
+static size_t read_bracketed_paste(char** burst, size_t* capacity) {
+    size_t length = 0;
+    int ch;
+
+    while ((ch = getch()) != KEY_PASTE_END && ch != ERR) {
+        if (ch > 255) {
+            continue;
+        }
+        if (append_to_burst(burst, capacity, &length, ch) < 0) {
+            break;
+        }
+    }
+
+    return length;
+}
+
+/* Reads a number typed after label on the status line. Enter accepts it;
+ * Esc, Ctrl+C or an empty entry cancels. Returns 1 with the number in
+ * *value. */
+static int prompt_number(const char* label, size_t* value) {
+    char digits[21];
+    size_t length = 0;
+    char message[96];
+
+    for (;;) {
+        snprintf(message, sizeof(message), "%s%.*s", label, (int)length, digits);
+        display_status_message(message);
+        move(LINES - 1, (int)strlen(message));
+        refresh();
+
+        int ch = getch();
+        if (ch >= '0' && ch <= '9' && length < sizeof(digits) - 1) {
+            digits[length++] = (char)ch;
+        } else if ((ch == KEY_BACKSPACE || ch == BACKSPACE) && length > 0) {
+            length--;
+        } else if (ch == '\n' || ch == '\r' || ch == KEY_ENTER) {
+            if (length == 0) return 0;
+            digits[length] = '\0';
+            *value = strtoull(digits, NULL, 10);
+            return 1;
+        } else if (ch == ESC || ch == CTRL_C || ch == ERR) {
+            return 0;
+        }
+    }
+}
+
+/* Finds the next (direction 1) or previous (-1) match from the one at
+ * *match, wrapping around the ends of the buffer. Sets *wrapped when it did. */
+static int step_search(Buffer* buf, const SearchPattern* pattern, int direction, size_t* match, int* wrapped) {
+    *wrapped = 0;
+    if (direction > 0) {
+        if (*match < buf->text_size && search_forward(buf, pattern, *match + 1, match)) return 1;
+        *wrapped = 1;
+        return search_forward(buf, pattern, 0, match);
+    }
+    if (*match > 0 && search_backward(buf, pattern, *match - 1, match)) return 1;
+    *wrapped = 1;
+    return search_backward(buf, pattern, buf->text_size, match);
+}
+
+/* Incremental search on the status line. A longer query can only match at
+ * or after the shorter one's match, so each typed character searches on
+ * from there, and Backspace goes back to the match the shorter query had.
+ * Ctrl+F or Down moves to the next match and Ctrl+R or Up to the previous
+ * one. Enter leaves the cursor on the match; Esc returns to where the
+ * search started. */
+static void incremental_search(Buffer* buf, size_t* x_pos, size_t* y_pos, size_t width) {
+    char query[SEARCH_MAX_PATTERN];
+    size_t matches[SEARCH_MAX_PATTERN + 1];
+    char found[SEARCH_MAX_PATTERN + 1];
+    size_t length = 0;
+    SearchPattern pattern;
+    char message[SEARCH_MAX_PATTERN + 64];
+    const char* note = "";
+    int cancelled = 0;
+
+    size_t first_line = buf->first_line;
+    size_t first_column = buf->first_column;
+    matches[0] = get_buffer_position(buf, *x_pos, *y_pos);
+    found[0] = 1;
+    compile_search_pattern(&pattern, query, 0);
+
+    for (;;) {
+        int prompt = snprintf(message, sizeof(message), "Search: %.*s", (int)length, query);
+        snprintf(message + prompt, sizeof(message) - (size_t)prompt, "%s", note);
+        display_status_message(message);
+        move(LINES - 1, prompt);
+        refresh();
+
+        int ch = getch();
+        int wrapped = 0;
+        if (ch >= 32 && ch <= 126) {
+            if (length == SEARCH_MAX_PATTERN) continue;
+            query[length++] = (char)ch;
+            compile_search_pattern(&pattern, query, length);
+            matches[length] = matches[length - 1];
+            found[length] = 0;
+            if (found[length - 1]) {
+                size_t match;
+                if (search_forward(buf, &pattern, matches[length - 1], &match) ||
+                    (wrapped = 1, search_forward(buf, &pattern, 0, &match))) {
+                    matches[length] = match;
+                    found[length] = 1;
+                }
+            }
+        } else if ((ch == KEY_BACKSPACE || ch == BACKSPACE) && length > 0) {
+            length--;
+            compile_search_pattern(&pattern, query, length);
+        } else if (ch == CTRL('f') || ch == KEY_DOWN || ch == CTRL('r') || ch == KEY_UP) {
+            if (length == 0 || !found[length]) continue;
+            step_search(buf, &pattern, ch == CTRL('f') || ch == KEY_DOWN ? 1 : -1, &matches[length], &wrapped);
+        } else if (ch == '\n' || ch == '\r' || ch == KEY_ENTER) {
+            break;
+        } else if (ch == ESC || ch == CTRL_C || ch == ERR) {
+            cancelled = 1;
+            break;
+        } else {
+            continue;
+        }
+
+        note = length > 0 && !found[length] ? " (not found)" : wrapped ? " (wrapped)" : "";
+        set_search_highlight(&pattern);
+        jump_to_position(buf, matches[length], x_pos, y_pos, width);
+    }
+
+    set_search_highlight(NULL);
+    if (cancelled) {
+        buf->first_line = first_line;
+        buf->first_column = first_column;
+        length = 0;
+    }
+    jump_to_position(buf, matches[length], x_pos, y_pos, width);
+}
+
+/* Reads a --history-mb value: a whole number of megabytes, 0 for no limit. */
+static int parse_history_mb(const char* text, size_t* mb) {
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || text[0] == '-' ||
+        value > SIZE_MAX / (1024 * 1024)) {
+        return -1;
+    }
+    *mb = (size_t)value;
+    return 0;
+}
+
+static void display_history_usage(History* history) {
+    char message[128];
+    double used_mb = history->bytes / (1024.0 * 1024.0);
+    
+    if (history->max_bytes > 0) {
+        snprintf(message, sizeof(message), "History: %d steps, %.1f of %zu MB",
+                 history->count, used_mb, history->max_bytes / (1024 * 1024));
+    } else {
+        snprintf(message, sizeof(message), "History: %d steps, %.1f MB (unbounded)",
+                 history->count, used_mb);
+    }
+    display_status_message(message);
+}
+
+/* Hands a snapshot of the buffer to the save thread, or queues a follow-up
+ * if a save is already running. Nothing is written when the buffer (or
+ * the running save) is already at the current generation. Returns 1 while
+ * a save is in progress. Without a save thread the file is written in
+ * place of the snapshot. */
+static int start_save(Saver* saver, Journal* journal, Buffer* buf, char* filename, int saving) {
+    if (saving ? buf->generation == saver->generation : buf->generation == buf->saved_generation) {
+        display_status_message(saving ? "Saving..." : "No changes to save");
+        return saving;
+    }
+    
+    if (!saver) {
+        if (save_contents_to_file(filename, buf) == 0) {
+            buf->saved_generation = buf->generation;
+            begin_journal_checkpoint(journal);
+            commit_journal_checkpoint(journal, filename);
+            display_status_message("File saved");
+        } else {
+            display_status_message("Save failed; edits are kept in the journal");
+        }
+        return 0;
+    }
+    
+    int started = request_save(saver, buf);
+    if (started == 1) {
+        begin_journal_checkpoint(journal);
+        display_status_message("Saving...");
+    } else if (started == 0) {
+        display_status_message("Saving... (another save queued)");
+    } else {
+        display_status_message("Save failed: out of memory");
+        return 0;
+    }
+    return 1;
+}
+
+/* Reports progress of a background save and finishes it once written.
+ * Returns 1 while a save is still in progress. */
+static int check_save(Saver* saver, Journal* journal, Buffer* buf, char* filename) {
+    size_t written, total;
+    int result, follow_up;
+    char message[64];
+    
+    SaveState state = poll_save(saver, &written, &total, &result, &follow_up);
+    if (state == SAVE_RUNNING) {
+        snprintf(message, sizeof(message), "Saving... %zu%%", total ? written * 100 / total : 100);
+        display_status_message(message);
+        return 1;
+    }
+    if (state != SAVE_DONE) {
+        return 0;
+    }
+    
+    if (result == 0) {
+        buf->saved_generation = saver->generation;
+        commit_journal_checkpoint(journal, filename);
+        display_status_message("File saved");
+    } else {
+        cancel_journal_checkpoint(journal);
+        display_status_message("Save failed; edits are kept in the journal");
+    }
+    
+    if (follow_up) {
+        return start_save(saver, journal, buf, filename, 0);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
     char filename[256] = {0};
+    const char* path = NULL;
+    size_t history_mb = HISTORY_DEFAULT_MB;
+    int use_pieces = 0;
+    int view_only = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--history-mb") == 0) {
+            if (i + 1 >= argc || parse_history_mb(argv[++i], &history_mb) < 0) {
+                fprintf(stderr, "Usage: %s [--history-mb N] [--piece-table] [--view] [filename]\n"
+                                "--history-mb takes a whole number of megabytes (0 for no limit)\n", argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--piece-table") == 0) {
+            use_pieces = 1;
+        } else if (strcmp(argv[i], "--view") == 0) {
+            view_only = 1;
+        } else {
+            path = argv[i];
+        }
+    }
+    
+    if (view_only && !path) {
+        fprintf(stderr, "--view needs a file name\n");
+        return 1;
+    }
+    if (view_only && access(path, R_OK) < 0) {
+        perror(path);
+        return 1;
+    }
     
-    if (!argv[1]) {
+    if (!path) {
         char ch;
         printf("No file Specified, would you like to create a file? Y/N: ");
         scanf("%c", &ch);
@@ -52,229 +357,235 @@ int main(int argc __attribute__((unused)), char** argv) {
             return 1;
         }
     } else {
-        strncpy(filename, argv[1], sizeof(filename) - 1);
+        strncpy(filename, path, sizeof(filename) - 1);
         filename[sizeof(filename) - 1] = '\0';
     }
     
-    Buffer* buf = create_buffer();
+    Buffer* buf = view_only ? create_view_buffer() : use_pieces ? create_piece_buffer() : create_buffer();
     
-    History* history = create_history(100);
+    History* history = create_history(history_mb * 1024 * 1024);
     
     initscr();
     raw();
     noecho();        
     keypad(stdscr, TRUE);  
+    define_key("\033[200~", KEY_PASTE_BEGIN);
+    define_key("\033[201~", KEY_PASTE_END);
+    printf("\033[?2004h");
+    fflush(stdout);
     refresh();
     
     size_t width, height;
     size_t X_POS = 1 + LINE_NUMBER_WIDTH, Y_POS = 0;
     getmaxyx(stdscr, height, width);
-    load_file_into_buffer(filename, buf, width);
+    load_file_into_buffer(filename, buf);
+    /* A view never changes the file, so it has nothing to journal. While
+     * another editor holds the journal, this one neither replays nor
+     * writes it. */
+    JournalRecovery recovery = {0};
+    int journal_fd = view_only ? -1 : lock_journal(filename);
+    Journal* journal = NULL;
+    if (journal_fd >= 0) {
+        replay_journal(journal_fd, filename, buf, &recovery);
+        if (recovery.stale < 0) {
+            close(journal_fd);
+        } else {
+            journal = open_journal(journal_fd, filename, recovery.replayed > 0 ? recovery.end : 0);
+        }
+    }
+    if (journal) {
+        buf->edit_observer = journal_edit;
+        buf->edit_context = journal;
+    }
     int ch;  
     cursor initial_coordinates = initial_buffer_render_on_window(buf, width, height);
 
     if (initial_coordinates.status == 0) {
-        X_POS = initial_coordinates.initial_x_pos + LINE_NUMBER_WIDTH;
+        X_POS = initial_coordinates.initial_x_pos + line_number_width(buf);
         Y_POS = initial_coordinates.initial_y_pos;
     }
     
+    move(Y_POS, X_POS);
     display_status_bar(buf, filename, X_POS, Y_POS);
     
-    while ((ch = getch()) != CTRL_Q) {
-        size_t pre_x = X_POS;
-        size_t pre_y = Y_POS;
-        size_t buffer_pos = get_buffer_position(X_POS - LINE_NUMBER_WIDTH, Y_POS, width, buf->first_character);
+    if (recovery.replayed > 0) {
+        char message[96];
+        snprintf(message, sizeof(message), "Recovered unsaved edits from journal (%zu records)", recovery.replayed);
+        display_status_message(message);
+    } else if (journal_fd == JOURNAL_BUSY) {
+        display_status_message("File is open in another editor; edits here are not journaled");
+    } else if (recovery.stale > 0) {
+        char message[4200];
+        const char* slash = strrchr(recovery.stale_path, '/');
+        snprintf(message, sizeof(message), "Journal was for another version of the file; kept as %s",
+                 slash ? slash + 1 : recovery.stale_path);
+        display_status_message(message);
+    } else if (recovery.stale < 0) {
+        display_status_message("Journal does not match the file and could not be kept; edits are not journaled");
+    }
+    
+    char* burst = NULL;
+    size_t burst_capacity = 0;
+    
+    Saver* saver = create_saver(filename);
+    int saving = 0;
+    int indexing = buffer_index_pending(buf);
+    
+    for (;;) {
+        timeout(saving || indexing ? SAVE_POLL_MS : -1);
+        ch = getch();
+        timeout(-1);
         
-        if (ch == CTRL('z')) {
-            if (undo(history, buf, &X_POS, &Y_POS, width)) {
-                redraw_window(buf, width);
-                move(Y_POS, X_POS);
+        /* The line count in the status bar becomes exact once the
+         * background index is taken up. */
+        if (indexing && buffer_poll_index(buf)) {
+            indexing = 0;
+            display_status_bar(buf, filename, X_POS, Y_POS);
+        }
+        if (saving) {
+            saving = check_save(saver, journal, buf, filename);
+            if (!saving) {
+                display_status_bar(buf, filename, X_POS, Y_POS);
+            }
+        }
+        if (ch == CTRL_Q) {
+            break;
+        }
+        if (ch == ERR) {
+            continue;
+        }
+        if (view_only && is_edit_key(ch)) {
+            if (ch == KEY_PASTE_BEGIN) {
+                read_bracketed_paste(&burst, &burst_capacity);
+            }
+            display_status_message("Read-only view");
+            move(Y_POS, X_POS);
+            continue;
+        }
+        
+        size_t buffer_pos = get_buffer_position(buf, X_POS, Y_POS);
+        size_t line = buf->first_line + Y_POS;
+        size_t column = buffer_pos - buffer_line_start(buf, line);
+        size_t target = buffer_pos;
+        
+        if (ch == KEY_PASTE_BEGIN) {
+            size_t paste_length = read_bracketed_paste(&burst, &burst_capacity);
+            if (paste_length > 0) {
+                record_insert_text(history, buffer_pos, burst, paste_length);
+                render_text_on_window(buf, &X_POS, &Y_POS, burst, paste_length, width);
             }
             display_status_bar(buf, filename, X_POS, Y_POS);
             continue;
-        } else if (ch == CTRL('y')) {
-            if (redo(history, buf, &X_POS, &Y_POS, width)) {
+        } else if (is_text_key(ch)) {
+            size_t burst_length = drain_typeahead(ch, &burst, &burst_capacity);
+            if (burst_length > 1) {
+                record_insert_text(history, buffer_pos, burst, burst_length);
+                render_text_on_window(buf, &X_POS, &Y_POS, burst, burst_length, width);
+                display_status_bar(buf, filename, X_POS, Y_POS);
+                continue;
+            }
+            if (ch == '\r') {
+                ch = '\n';
+            }
+        }
+        
+        if (ch == CTRL('z') || ch == CTRL('y')) {
+            int changed = ch == CTRL('z') ? undo(history, buf, &target) : redo(history, buf, &target);
+            if (changed) {
+                scroll_to_position(buf, target, &X_POS, &Y_POS, width);
                 redraw_window(buf, width);
                 move(Y_POS, X_POS);
             }
             display_status_bar(buf, filename, X_POS, Y_POS);
             continue;
         } else if (ch == CTRL('s')) {
-            save_contents_to_file(filename, buf, width);
-            display_status_message("File saved");
+            saving = start_save(saver, journal, buf, filename, saving);
+            display_status_bar(buf, filename, X_POS, Y_POS);
+            move(Y_POS, X_POS);
+            continue;
+        } else if (ch == CTRL('g')) {
+            display_history_usage(history);
+            move(Y_POS, X_POS);
+            continue;
+        } else if (ch == CTRL('l') || ch == CTRL('o')) {
+            size_t value;
+            close_history_span(history);
+            if (ch == CTRL('l') ? prompt_number("Go to line: ", &value) : prompt_number("Go to byte offset: ", &value)) {
+                target = ch == CTRL('l') ? buffer_position_of(buf, value > 0 ? value - 1 : 0, 0)
+                                         : value < buf->text_size ? value : buf->text_size;
+                jump_to_position(buf, target, &X_POS, &Y_POS, width);
+            }
+            move(Y_POS, X_POS);
             display_status_bar(buf, filename, X_POS, Y_POS);
+            continue;
+        } else if (ch == CTRL('f')) {
+            close_history_span(history);
+            incremental_search(buf, &X_POS, &Y_POS, width);
             move(Y_POS, X_POS);
+            display_status_bar(buf, filename, X_POS, Y_POS);
             continue;
         }
-        
+
         switch (ch) {
             case KEY_BACKSPACE:
-                if (X_POS > 1 + LINE_NUMBER_WIDTH) {
-                    size_t del_pos = (X_POS - 2 - LINE_NUMBER_WIDTH) + Y_POS * (width - 2) + buf->first_character;
-                    char del_char = ' ';
-                    
-                    if (del_pos < buf->text_size) {
-                        if (del_pos < buf->gap_start) {
-                            del_char = buf->buffer[del_pos];
-                        } else {
-                            del_char = buf->buffer[buf->gap_end + (del_pos - buf->gap_start)];
-                        }
-                    }
-                    
-                    X_POS--;
-                    record_delete(history, del_pos, del_char, pre_x, pre_y);
-                    render_backspace_on_window(buf, X_POS - LINE_NUMBER_WIDTH, Y_POS, width);
-                    display_status_bar(buf, filename, X_POS, Y_POS);
-                } else if (X_POS == 1 + LINE_NUMBER_WIDTH && Y_POS > 0) {
-                    size_t prev_line_end = ((Y_POS - 1) * (width - 2) + (width - 2) - 1) + buf->first_character;
-                    char del_char = ' ';
-                    
-                    if (prev_line_end < buf->text_size) {
-                        if (prev_line_end < buf->gap_start) {
-                            del_char = buf->buffer[prev_line_end];
-                        } else {
-                            del_char = buf->buffer[buf->gap_end + (prev_line_end - buf->gap_start)];
-                        }
-                    }
-                    
-                    X_POS = width - 1;
-                    Y_POS--;
-                    record_delete(history, prev_line_end, del_char, pre_x, pre_y);
-                    move(Y_POS, X_POS);
-                    display_status_bar(buf, filename, X_POS, Y_POS);
+            case BACKSPACE:
+                if (buffer_pos > 0) {
+                    record_delete(history, buffer_pos - 1, buffer_char_at(buf, buffer_pos - 1));
+                    render_backspace_on_window(buf, &X_POS, &Y_POS, width);
                 }
+                display_status_bar(buf, filename, X_POS, Y_POS);
                 break;
             case KEY_DC:
-                if (X_POS > 1 + LINE_NUMBER_WIDTH) {
-                    size_t del_pos = (X_POS - 2 - LINE_NUMBER_WIDTH) + Y_POS * (width - 2) + buf->first_character;
-                    char del_char = ' ';
-                    
-                    if (del_pos < buf->text_size) {
-                        if (del_pos < buf->gap_start) {
-                            del_char = buf->buffer[del_pos];
-                        } else {
-                            del_char = buf->buffer[buf->gap_end + (del_pos - buf->gap_start)];
-                        }
-                    }
-                    
-                    X_POS--;
-                    record_delete(history, del_pos, del_char, pre_x, pre_y);
-                    render_backspace_on_window(buf, X_POS - LINE_NUMBER_WIDTH, Y_POS, width);
-                    display_status_bar(buf, filename, X_POS, Y_POS);
-                } else if (X_POS == 1 + LINE_NUMBER_WIDTH && Y_POS > 0) {
-                    X_POS = width - 1;
-                    Y_POS--;
-                    move(Y_POS, X_POS);
-                    display_status_bar(buf, filename, X_POS, Y_POS);
-                }
-                break;
-            case KEY_UP:
-                if (Y_POS == 0 && buf->first_character > 0) {
-                    buf->first_character -= (width - 2);
-                    buf->last_character -= (width - 2);
-                    redraw_window(buf, width);
-                    
-                    move(Y_POS, X_POS);
-                }
-                if (Y_POS > 0) {
-                    Y_POS--;
-                    move(Y_POS, X_POS);
+                if (buffer_pos < buf->text_size) {
+                    record_delete(history, buffer_pos, buffer_char_at(buf, buffer_pos));
+                    render_delete_on_window(buf, X_POS, Y_POS, width);
                 }
                 display_status_bar(buf, filename, X_POS, Y_POS);
                 break;
+            case KEY_UP:
             case KEY_DOWN:
-                if (Y_POS >= height - 1) {
-                    size_t max_first = buf->text_size > (width - 2) ? buf->text_size - (width - 2) : 0;
-                    
-                    if (buf->first_character < max_first) {
-                        buf->first_character += (width - 2);
-                        buf->last_character += (width - 2);
-                        
-                        if (buf->first_character > max_first) {
-                            buf->first_character = max_first;
-                        }
-                        
-                        size_t buffer_index = (X_POS - 1) + Y_POS * (width - 2) + buf->first_character;
-                        
-                        if (buffer_index > buf->text_size) {
-                            move_buffer_cursor(buf, buf->text_size);
-                            
-                            while (buf->text_size < buffer_index) {
-                                if ((buf->text_size % (width - 2)) == 0 && buf->text_size > 0) {
-                                    insert_buffer(buf, '\n');
-                                } else {
-                                    insert_buffer(buf, ' ');
-                                }
-                            }
-                        }
-                        
-                        move_buffer_cursor(buf, buffer_index);
-                        redraw_window(buf, width);
-                        
-                        move(Y_POS, X_POS);
-                    }
-                } else {
-                    Y_POS++;
-                    move(Y_POS, X_POS);
+            case KEY_LEFT:
+            case KEY_RIGHT:
+                if (ch == KEY_UP && line > 0) {
+                    target = buffer_position_of(buf, line - 1, column);
+                } else if (ch == KEY_DOWN && line + 1 < buffer_line_count(buf)) {
+                    target = buffer_position_of(buf, line + 1, column);
+                } else if (ch == KEY_LEFT && buffer_pos > 0) {
+                    target = buffer_pos - 1;
+                } else if (ch == KEY_RIGHT && buffer_pos < buf->text_size) {
+                    target = buffer_pos + 1;
                 }
+                
+                close_history_span(history);
+                if (scroll_to_position(buf, target, &X_POS, &Y_POS, width)) {
+                    redraw_window(buf, width);
+                }
+                move(Y_POS, X_POS);
                 display_status_bar(buf, filename, X_POS, Y_POS);
                 break;
-            case KEY_LEFT:
-                if (X_POS > 1 + LINE_NUMBER_WIDTH) {
-                    X_POS--;
-                    move(Y_POS, X_POS);
-                } else if (X_POS == 1 + LINE_NUMBER_WIDTH && Y_POS > 0) {
-                    X_POS = width - 1;
-                    Y_POS--;
-                    
-                    if (Y_POS == 0 && buf->first_character > 0) {
-                        buf->first_character -= (width - 2);
-                        buf->last_character -= (width - 2);
-                        redraw_window(buf, width);
-                        Y_POS = 0;
-                    }
-                    
-                    move(Y_POS, X_POS);
-                }
+            case KEY_PPAGE:
+            case KEY_NPAGE:
+                close_history_span(history);
+                scroll_page(buf, ch == KEY_PPAGE ? -1 : 1, &X_POS, &Y_POS, width);
+                move(Y_POS, X_POS);
                 display_status_bar(buf, filename, X_POS, Y_POS);
                 break;
-            case KEY_RIGHT:
-                if (X_POS < width - 1) {
-                    X_POS++;
-                    move(Y_POS, X_POS);
-                } else if (X_POS == width - 1) {
-                    X_POS = 1;
-                    Y_POS++;
-                    
-                    if (Y_POS >= height - 1) {
-                        size_t max_first = buf->text_size > (width - 2) ? buf->text_size - (width - 2) : 0;
-                        
-                        if (buf->first_character < max_first) {
-                            buf->first_character += (width - 2);
-                            buf->last_character += (width - 2);
-                            
-                            if (buf->first_character > max_first) {
-                                buf->first_character = max_first;
-                            }
-                            
-                            redraw_window(buf, width);
-                            Y_POS = height - 2;
-                        }
-                    }
-                    
-                    move(Y_POS, X_POS);
-                }
+            case KEY_HOME:
+            case KEY_END:
+                close_history_span(history);
+                jump_to_position(buf, ch == KEY_HOME ? 0 : buf->text_size, &X_POS, &Y_POS, width);
+                move(Y_POS, X_POS);
                 display_status_bar(buf, filename, X_POS, Y_POS);
                 break;
             case ' ':
-                record_insert(history, buffer_pos, ' ', pre_x, pre_y);
+                record_insert(history, buffer_pos, ' ');
                 render_space_on_window(buf, &X_POS, &Y_POS, width);
                 display_status_bar(buf, filename, X_POS, Y_POS);
                 break;
             case 0x0A:
                 start_batch(history);
                 
-                record_enter(history, buffer_pos, pre_x, pre_y);
+                record_enter(history, buffer_pos);
                 
                 render_enter_on_window(buf, &X_POS, &Y_POS, width);
                 
@@ -283,17 +594,31 @@ int main(int argc __attribute__((unused)), char** argv) {
                 break;
             default:
                 if (ch >= 32 && ch <= 126) {
-                    record_insert(history, buffer_pos, ch, pre_x, pre_y);
+                    record_insert(history, buffer_pos, ch);
+                    update_general_window(buf, &X_POS, &Y_POS, ch, width);
+                    display_status_bar(buf, filename, X_POS, Y_POS);
                 }
-                update_general_window(buf, &X_POS, &Y_POS, ch, width);
-                display_status_bar(buf, filename, X_POS, Y_POS);
         }
         
         refresh();
     }
-    save_contents_to_file(filename, buf, width);
+    while (saving) {
+        napms(SAVE_POLL_MS);
+        saving = check_save(saver, journal, buf, filename);
+    }
+    free_saver(saver);
+    
+    int saved = 1;
+    if (buf->generation != buf->saved_generation) {
+        saved = save_contents_to_file(filename, buf) == 0;
+    }
+    buf->edit_observer = NULL;
+    close_journal(journal, saved);
+    printf("\033[?2004l");
+    fflush(stdout);
     endwin();
     
+    free(burst);
     free_history(history);
     free_buffer(buf);
     return 0;
@@ -0,0 +1,708 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "piece_table.h"
+#include "scan.h"
+
+#define ADD_INITIAL_CAPACITY 4096
+#define ADD_NEWLINES_INITIAL_CAPACITY 64
+
+/* An insert or delete splits at most two pieces. */
+#define PIECE_SPARES 2
+
+static unsigned int next_priority(PieceTable* table) {
+    unsigned int x = table->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    table->seed = x;
+    return x;
+}
+
+static const char* source_text(PieceTable* table, PieceSource source) {
+    return source == PIECE_ORIGINAL ? table->original : table->add;
+}
+
+/* Index of the first newline offset in values that is >= key. */
+static size_t lower_bound(const size_t* values, size_t count, size_t key) {
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (values[mid] < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static const size_t* source_newlines(PieceTable* table, PieceSource source, size_t* count) {
+    if (source == PIECE_ORIGINAL) {
+        *count = table->original_newline_count;
+        return table->original_newlines;
+    }
+    *count = table->add_newline_count;
+    return table->add_newlines;
+}
+
+/* Newlines in [start, start + length) of the piece's source. */
+static size_t count_piece_newlines(PieceTable* table, PieceSource source, size_t start, size_t length) {
+    if (!table->indexed) return 0;
+
+    size_t count;
+    const size_t* newlines = source_newlines(table, source, &count);
+    return lower_bound(newlines, count, start + length) - lower_bound(newlines, count, start);
+}
+
+static size_t subtree_length(Piece* node) {
+    return node ? node->total_length : 0;
+}
+
+static size_t subtree_newlines(Piece* node) {
+    return node ? node->total_newlines : 0;
+}
+
+static void update_piece(Piece* node) {
+    node->total_length = subtree_length(node->left) + node->length + subtree_length(node->right);
+    node->total_newlines = subtree_newlines(node->left) + node->newlines + subtree_newlines(node->right);
+}
+
+static int reserve_spares(PieceTable* table) {
+    while (table->spare_count < PIECE_SPARES) {
+        Piece* node = (Piece*)malloc(sizeof(Piece));
+        if (!node) {
+            perror("Failed to allocate piece");
+            return -1;
+        }
+        node->right = table->spare;
+        table->spare = node;
+        table->spare_count++;
+    }
+    return 0;
+}
+
+/* Takes a node from the spares reserved at the start of the edit, so a
+ * split can never fail halfway through. */
+static Piece* new_piece(PieceTable* table, PieceSource source, size_t start, size_t length) {
+    Piece* node = table->spare;
+    table->spare = node->right;
+    table->spare_count--;
+
+    node->left = NULL;
+    node->right = NULL;
+    node->priority = next_priority(table);
+    node->source = source;
+    node->start = start;
+    node->length = length;
+    node->newlines = count_piece_newlines(table, source, start, length);
+    update_piece(node);
+
+    table->piece_count++;
+    return node;
+}
+
+static Piece* merge_pieces(Piece* left, Piece* right) {
+    if (!left) return right;
+    if (!right) return left;
+
+    if (left->priority > right->priority) {
+        left->right = merge_pieces(left->right, right);
+        update_piece(left);
+        return left;
+    }
+    right->left = merge_pieces(left, right->left);
+    update_piece(right);
+    return right;
+}
+
+/* Splits node into the first position bytes and the rest, cutting the
+ * piece that straddles position in two. */
+static void split_pieces(PieceTable* table, Piece* node, size_t position, Piece** left, Piece** right) {
+    if (!node) {
+        *left = NULL;
+        *right = NULL;
+        return;
+    }
+
+    size_t left_length = subtree_length(node->left);
+    if (position <= left_length) {
+        split_pieces(table, node->left, position, left, &node->left);
+        update_piece(node);
+        *right = node;
+    } else if (position >= left_length + node->length) {
+        split_pieces(table, node->right, position - left_length - node->length, &node->right, right);
+        update_piece(node);
+        *left = node;
+    } else {
+        size_t offset = position - left_length;
+        Piece* tail = new_piece(table, node->source, node->start + offset, node->length - offset);
+        Piece* rest = node->right;
+
+        node->length = offset;
+        node->newlines -= tail->newlines;
+        node->right = NULL;
+        update_piece(node);
+
+        *left = node;
+        *right = merge_pieces(tail, rest);
+    }
+}
+
+/* Grows the last piece of node in place when the new text directly
+ * follows it in the add buffer, so typing does not add a piece per key. */
+static int extend_last_piece(PieceTable* table, Piece* node, size_t start, size_t length) {
+    if (!node) return 0;
+
+    if (node->right) {
+        if (!extend_last_piece(table, node->right, start, length)) return 0;
+    } else {
+        if (node->source != PIECE_ADD || node->start + node->length != start) return 0;
+        node->length += length;
+        node->newlines += count_piece_newlines(table, PIECE_ADD, start, length);
+    }
+    update_piece(node);
+    return 1;
+}
+
+/* Each add-buffer byte belongs to at most one piece, so a freed piece at
+ * the end of the add buffer can be handed back for the next insert. */
+static void free_pieces(PieceTable* table, Piece* node) {
+    if (!node) return;
+
+    free_pieces(table, node->left);
+    free_pieces(table, node->right);
+
+    if (node->source == PIECE_ADD && node->start + node->length == table->add_size) {
+        table->add_size = node->start;
+        while (table->add_newline_count > 0 &&
+               table->add_newlines[table->add_newline_count - 1] >= table->add_size) {
+            table->add_newline_count--;
+        }
+    }
+
+    free(node);
+    table->piece_count--;
+}
+
+static int append_add(PieceTable* table, const char* text, size_t length) {
+    if (table->add_size + length > table->add_capacity) {
+        size_t capacity = table->add_capacity ? table->add_capacity * 2 : ADD_INITIAL_CAPACITY;
+        while (capacity < table->add_size + length) {
+            capacity *= 2;
+        }
+        char* grown = (char*)realloc(table->add, capacity);
+        if (!grown) {
+            perror("Failed to grow add buffer");
+            return -1;
+        }
+        table->add = grown;
+        table->add_capacity = capacity;
+    }
+
+    size_t newlines = length == 1 ? (text[0] == '\n') : scan_count_newlines(text, length);
+    if (table->add_newline_count + newlines > table->add_newline_capacity) {
+        size_t capacity = table->add_newline_capacity ? table->add_newline_capacity * 2
+                                                      : ADD_NEWLINES_INITIAL_CAPACITY;
+        while (capacity < table->add_newline_count + newlines) {
+            capacity *= 2;
+        }
+        size_t* grown = (size_t*)realloc(table->add_newlines, capacity * sizeof(size_t));
+        if (!grown) {
+            perror("Failed to grow add buffer line index");
+            return -1;
+        }
+        table->add_newlines = grown;
+        table->add_newline_capacity = capacity;
+    }
+
+    memcpy(table->add + table->add_size, text, length);
+    if (newlines > 0) {
+        table->add_newline_count += scan_newline_positions(text, length, table->add_size,
+                                                           table->add_newlines + table->add_newline_count);
+    }
+    table->add_size += length;
+    return 0;
+}
+
+static void reset_sparse_index(PieceTable* table) {
+    free(table->sparse_starts);
+    table->sparse_starts = NULL;
+    table->sparse_count = 0;
+    table->sparse_capacity = 0;
+    table->sparse_scanned = 0;
+    table->sparse_lines = 1;
+    table->sparse_block = (size_t)-1;
+}
+
+PieceTable* create_piece_table(void) {
+    PieceTable* table = (PieceTable*)calloc(1, sizeof(PieceTable));
+    if (!table) {
+        perror("Failed to allocate memory for piece table");
+        return NULL;
+    }
+
+    table->seed = 2463534242u;
+    table->indexed = 1;
+    reset_sparse_index(table);
+    return table;
+}
+
+static void unmap_original(PieceTable* table) {
+    free_index_job(table->index_job);
+    table->index_job = NULL;
+    if (table->original) {
+        munmap((void*)table->original, table->original_size);
+    }
+    free(table->original_newlines);
+    table->original = NULL;
+    table->original_size = 0;
+    table->original_newlines = NULL;
+    table->original_newline_count = 0;
+    reset_sparse_index(table);
+}
+
+void free_piece_table(PieceTable* table) {
+    if (!table) return;
+
+    free_pieces(table, table->root);
+    while (table->spare) {
+        Piece* next = table->spare->right;
+        free(table->spare);
+        table->spare = next;
+    }
+    unmap_original(table);
+    free(table->sparse_newlines);
+    free(table->add);
+    free(table->add_newlines);
+    free(table);
+}
+
+long long piece_table_open(PieceTable* table, const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Error reading file size");
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* mapped = NULL;
+    if (size > 0) {
+        mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            perror("Error mapping file");
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+
+    free_pieces(table, table->root);
+    table->root = NULL;
+    unmap_original(table);
+    table->add_size = 0;
+    table->add_newline_count = 0;
+
+    table->original = (const char*)mapped;
+    table->original_size = size;
+    table->cursor = size;
+    table->indexed = size == 0;
+
+    if (size > 0) {
+        if (reserve_spares(table) < 0) {
+            unmap_original(table);
+            return -1;
+        }
+        table->root = new_piece(table, PIECE_ORIGINAL, 0, size);
+    }
+
+    return (long long)size;
+}
+
+size_t piece_table_size(PieceTable* table) {
+    return subtree_length(table->root);
+}
+
+int piece_table_insert(PieceTable* table, size_t position, const char* text, size_t length) {
+    if (length == 0) return 0;
+    if (position > piece_table_size(table)) return -1;
+    if (reserve_spares(table) < 0) return -1;
+
+    size_t start = table->add_size;
+    if (append_add(table, text, length) < 0) {
+        return -1;
+    }
+
+    Piece* left;
+    Piece* right;
+    split_pieces(table, table->root, position, &left, &right);
+    if (!extend_last_piece(table, left, start, length)) {
+        left = merge_pieces(left, new_piece(table, PIECE_ADD, start, length));
+    }
+    table->root = merge_pieces(left, right);
+    table->cursor = position + length;
+    return 0;
+}
+
+int piece_table_delete(PieceTable* table, size_t position, size_t length) {
+    size_t size = piece_table_size(table);
+    if (position >= size || length == 0) return 0;
+    if (length > size - position) {
+        length = size - position;
+    }
+    if (reserve_spares(table) < 0) return -1;
+
+    Piece* left;
+    Piece* rest;
+    Piece* middle;
+    Piece* right;
+    split_pieces(table, table->root, position, &left, &rest);
+    split_pieces(table, rest, length, &middle, &right);
+    free_pieces(table, middle);
+    table->root = merge_pieces(left, right);
+    table->cursor = position;
+    return 0;
+}
+
+const char* piece_table_chunk(PieceTable* table, size_t position, size_t* length) {
+    Piece* node = table->root;
+    while (node) {
+        size_t left_length = subtree_length(node->left);
+        if (position < left_length) {
+            node = node->left;
+            continue;
+        }
+        position -= left_length;
+        if (position < node->length) {
+            size_t available = node->length - position;
+            if (*length > available) {
+                *length = available;
+            }
+            return source_text(table, node->source) + node->start + position;
+        }
+        position -= node->length;
+        node = node->right;
+    }
+
+    *length = 0;
+    return NULL;
+}
+
+/* Like piece_table_chunk, but for the piece holding the byte before
+ * position; the run returned ends at position. */
+const char* piece_table_chunk_before(PieceTable* table, size_t position, size_t* length) {
+    if (position == 0) {
+        *length = 0;
+        return NULL;
+    }
+
+    position--;
+    Piece* node = table->root;
+    while (node) {
+        size_t left_length = subtree_length(node->left);
+        if (position < left_length) {
+            node = node->left;
+            continue;
+        }
+        position -= left_length;
+        if (position < node->length) {
+            size_t available = position + 1;
+            if (*length > available) {
+                *length = available;
+            }
+            return source_text(table, node->source) + node->start + available - *length;
+        }
+        position -= node->length;
+        node = node->right;
+    }
+
+    *length = 0;
+    return NULL;
+}
+
+size_t piece_table_read(PieceTable* table, size_t position, size_t length, char* out) {
+    size_t copied = 0;
+    while (copied < length) {
+        size_t chunk_length = length - copied;
+        const char* chunk = piece_table_chunk(table, position + copied, &chunk_length);
+        if (!chunk) break;
+        memcpy(out + copied, chunk, chunk_length);
+        copied += chunk_length;
+    }
+    return copied;
+}
+
+static void recount_newlines(PieceTable* table, Piece* node) {
+    if (!node) return;
+    recount_newlines(table, node->left);
+    recount_newlines(table, node->right);
+    node->newlines = count_piece_newlines(table, node->source, node->start, node->length);
+    update_piece(node);
+}
+
+int piece_table_build_index(PieceTable* table) {
+    if (table->indexed) return 0;
+
+    size_t count;
+    size_t* newlines = index_newlines(table->original, table->original_size, 0, 0, &count, NULL, NULL);
+    if (!newlines) return -1;
+
+    table->original_newlines = newlines;
+    table->original_newline_count = count;
+    table->indexed = 1;
+    recount_newlines(table, table->root);
+    return 0;
+}
+
+size_t piece_table_line_count(PieceTable* table) {
+    return subtree_newlines(table->root) + 1;
+}
+
+size_t piece_table_line_start(PieceTable* table, size_t line) {
+    if (line == 0) return 0;
+
+    /* Line n starts after the n-th newline. */
+    size_t target = line - 1;
+    size_t base = 0;
+    Piece* node = table->root;
+    while (node) {
+        size_t left_newlines = subtree_newlines(node->left);
+        if (target < left_newlines) {
+            node = node->left;
+            continue;
+        }
+        target -= left_newlines;
+        base += subtree_length(node->left);
+
+        if (target < node->newlines) {
+            size_t count;
+            const size_t* newlines = source_newlines(table, node->source, &count);
+            size_t first = lower_bound(newlines, count, node->start);
+            return base + (newlines[first + target] - node->start) + 1;
+        }
+        target -= node->newlines;
+        base += node->length;
+        node = node->right;
+    }
+    return piece_table_size(table);
+}
+
+size_t piece_table_line_of_position(PieceTable* table, size_t position) {
+    size_t line = 0;
+    Piece* node = table->root;
+    while (node) {
+        size_t left_length = subtree_length(node->left);
+        if (position < left_length) {
+            node = node->left;
+            continue;
+        }
+        position -= left_length;
+        line += subtree_newlines(node->left);
+
+        if (position < node->length) {
+            return line + count_piece_newlines(table, node->source, node->start, position);
+        }
+        position -= node->length;
+        line += node->newlines;
+        node = node->right;
+    }
+    return line;
+}
+
+/* Add-buffer pieces are taken from add_text, the add buffer or a copy of it. */
+static size_t collect_segments(PieceTable* table, Piece* node, const char* add_text, struct iovec* out, size_t count) {
+    if (!node) return count;
+
+    count = collect_segments(table, node->left, add_text, out, count);
+    const char* text = node->source == PIECE_ORIGINAL ? table->original : add_text;
+    out[count].iov_base = (void*)(text + node->start);
+    out[count].iov_len = node->length;
+    count++;
+    return collect_segments(table, node->right, add_text, out, count);
+}
+
+size_t piece_table_segments(PieceTable* table, struct iovec* out) {
+    return collect_segments(table, table->root, table->add, out, 0);
+}
+
+size_t piece_table_snapshot(PieceTable* table, struct iovec* out, char* add_copy) {
+    if (table->add_size > 0) {
+        memcpy(add_copy, table->add, table->add_size);
+    }
+    return collect_segments(table, table->root, add_copy, out, 0);
+}
+
+static int reserve_sparse_scratch(PieceTable* table) {
+    if (!table->sparse_newlines) {
+        table->sparse_newlines = (size_t*)malloc(SPARSE_SCAN_BYTES * sizeof(size_t));
+        if (!table->sparse_newlines) {
+            perror("Failed to allocate line scan buffer");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Scans the next SPARSE_SCAN_BYTES of the original, recording the start of
+ * every SPARSE_LINE_STRIDE-th line. */
+static int scan_sparse_chunk(PieceTable* table) {
+    if (reserve_sparse_scratch(table) < 0) return -1;
+    if (table->sparse_count == 0) {
+        table->sparse_starts = (size_t*)malloc(64 * sizeof(size_t));
+        if (!table->sparse_starts) {
+            perror("Failed to allocate sparse line index");
+            return -1;
+        }
+        table->sparse_capacity = 64;
+        table->sparse_starts[table->sparse_count++] = 0;
+    }
+
+    size_t from = table->sparse_scanned;
+    size_t length = table->original_size - from;
+    if (length > SPARSE_SCAN_BYTES) {
+        length = SPARSE_SCAN_BYTES;
+    }
+
+    /* The scratch buffer also holds the decoded block. */
+    table->sparse_block = (size_t)-1;
+    size_t found = scan_newline_positions(table->original + from, length, from + 1, table->sparse_newlines);
+    for (size_t i = 0; i < found; i++) {
+        if (table->sparse_lines % SPARSE_LINE_STRIDE == 0) {
+            if (table->sparse_count == table->sparse_capacity) {
+                size_t* grown = (size_t*)realloc(table->sparse_starts,
+                                                 table->sparse_capacity * 2 * sizeof(size_t));
+                if (!grown) {
+                    perror("Failed to grow sparse line index");
+                    return -1;
+                }
+                table->sparse_starts = grown;
+                table->sparse_capacity *= 2;
+            }
+            table->sparse_starts[table->sparse_count++] = table->sparse_newlines[i];
+        }
+        table->sparse_lines++;
+    }
+    table->sparse_scanned = from + length;
+
+    /* Drop the whole pages just scanned; they fault back in if shown. */
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)(table->original + from) + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t last = (uintptr_t)(table->original + from + length) & ~(uintptr_t)(page - 1);
+    if (last > first) {
+        madvise((void*)first, last - first, MADV_DONTNEED);
+    }
+    return 0;
+}
+
+/* Fills sparse_newlines[i] with the start of line block * SPARSE_LINE_STRIDE + i
+ * for the lines of block found so far. */
+static void decode_sparse_block(PieceTable* table, size_t block) {
+    size_t start = table->sparse_starts[block];
+    size_t end = block + 1 < table->sparse_count ? table->sparse_starts[block + 1] : table->sparse_scanned;
+    if (table->sparse_block == block && table->sparse_block_end == end) {
+        return;
+    }
+
+    /* The region holds at most SPARSE_LINE_STRIDE newlines, the last of
+     * which starts the next block. */
+    table->sparse_newlines[0] = start;
+    size_t found = 0;
+    if (end > start) {
+        found = scan_newline_positions(table->original + start, end - start, start + 1,
+                                       table->sparse_newlines + 1);
+    }
+    table->sparse_block = block;
+    table->sparse_block_end = end;
+    table->sparse_block_count = 1 + found;
+}
+
+int piece_table_sparse_complete(PieceTable* table) {
+    return table->sparse_scanned >= table->original_size;
+}
+
+size_t piece_table_sparse_line_count(PieceTable* table, size_t line) {
+    while (!piece_table_sparse_complete(table) && table->sparse_lines <= line + SPARSE_LOOKAHEAD_LINES) {
+        if (scan_sparse_chunk(table) < 0) break;
+    }
+    return table->sparse_lines;
+}
+
+size_t piece_table_sparse_line_start(PieceTable* table, size_t line) {
+    if (line == 0) return 0;
+    if (line >= piece_table_sparse_line_count(table, line)) {
+        return table->original_size;
+    }
+
+    decode_sparse_block(table, line / SPARSE_LINE_STRIDE);
+    return table->sparse_newlines[line % SPARSE_LINE_STRIDE];
+}
+
+size_t piece_table_sparse_line_of_position(PieceTable* table, size_t position) {
+    while (!piece_table_sparse_complete(table) && table->sparse_scanned <= position) {
+        if (scan_sparse_chunk(table) < 0) return 0;
+    }
+    if (table->sparse_count == 0) return 0;
+
+    size_t block = lower_bound(table->sparse_starts, table->sparse_count, position + 1) - 1;
+    decode_sparse_block(table, block);
+    size_t index = lower_bound(table->sparse_newlines, table->sparse_block_count, position + 1) - 1;
+    return block * SPARSE_LINE_STRIDE + index;
+}
+
+int piece_table_start_index(PieceTable* table, int sparse) {
+    if (!table->original || table->index_job) return 0;
+    if (!sparse && table->indexed) return 0;
+
+    table->index_job = start_index_job(table->original, table->original_size,
+                                       sparse ? SPARSE_LINE_STRIDE : 0);
+    return table->index_job ? 0 : -1;
+}
+
+int piece_table_poll_index(PieceTable* table, int wait) {
+    IndexJob* job = table->index_job;
+    if (!job) return -1;
+    if (!wait && !index_job_done(job)) return 0;
+
+    wait_index_job(job);
+    table->index_job = NULL;
+    if (!job->starts || (job->stride && reserve_sparse_scratch(table) < 0)) {
+        free_index_job(job);
+        return -1;
+    }
+
+    if (job->stride) {
+        /* The whole file is scanned now; the lazy scan's progress is moot. */
+        free(table->sparse_starts);
+        table->sparse_starts = job->starts;
+        table->sparse_count = job->count;
+        table->sparse_capacity = job->count;
+        table->sparse_lines = job->lines;
+        table->sparse_scanned = table->original_size;
+        table->sparse_block = (size_t)-1;
+    } else {
+        table->original_newlines = job->starts;
+        table->original_newline_count = job->count;
+        table->original_words = job->words;
+        table->original_non_blank = job->non_blank;
+        table->indexed = 1;
+        recount_newlines(table, table->root);
+        reset_sparse_index(table);
+    }
+
+    job->starts = NULL;
+    free_index_job(job);
+    return 1;
+}
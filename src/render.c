@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ncurses.h>
+#include "render.h"
+
+static void ncurses_get_size(RenderBackend* backend, int* rows, int* cols) {
+    (void)backend;
+    getmaxyx(stdscr, *rows, *cols);
+}
+
+static void ncurses_clear_row(RenderBackend* backend, int y) {
+    (void)backend;
+    move(y, 0);
+    clrtoeol();
+}
+
+static chtype attr_bits(RenderAttr attr) {
+    switch (attr) {
+        case RENDER_DIM:
+            return A_DIM;
+        case RENDER_REVERSE:
+            return A_REVERSE;
+        default:
+            return COLOR_PAIR(1);
+    }
+}
+
+/* Converts the run to chtypes and writes it with one addchnstr call. */
+static void ncurses_put_text(RenderBackend* backend, int y, int x, const char* text, size_t length, RenderAttr attr) {
+    static chtype* cells = NULL;
+    static size_t cells_capacity = 0;
+    static int colors_initialized = 0;
+    (void)backend;
+
+    if (!colors_initialized) {
+        start_color();
+        init_pair(20, COLOR_BLACK, COLOR_WHITE);
+        init_pair(21, COLOR_BLACK, COLOR_WHITE);
+        colors_initialized = 1;
+    }
+
+    if (length > cells_capacity) {
+        chtype* grown = (chtype*)realloc(cells, length * sizeof(chtype));
+        if (!grown) {
+            perror("Failed to allocate row buffer");
+            return;
+        }
+        cells = grown;
+        cells_capacity = length;
+    }
+
+    chtype bits = attr_bits(attr);
+    for (size_t i = 0; i < length; i++) {
+        cells[i] = (chtype)(unsigned char)text[i] | bits;
+    }
+    mvaddchnstr(y, x, cells, (int)length);
+}
+
+static void ncurses_get_cursor(RenderBackend* backend, int* y, int* x) {
+    (void)backend;
+    getyx(stdscr, *y, *x);
+}
+
+static void ncurses_move_cursor(RenderBackend* backend, int y, int x) {
+    (void)backend;
+    move(y, x);
+}
+
+static void ncurses_present(RenderBackend* backend) {
+    (void)backend;
+    refresh();
+}
+
+static RenderBackend ncurses = {
+    ncurses_get_size,
+    ncurses_clear_row,
+    ncurses_put_text,
+    ncurses_get_cursor,
+    ncurses_move_cursor,
+    ncurses_present
+};
+
+RenderBackend* ncurses_backend(void) {
+    return &ncurses;
+}
+
+static void frame_get_size(RenderBackend* backend, int* rows, int* cols) {
+    Framebuffer* frame = (Framebuffer*)backend;
+    *rows = frame->rows;
+    *cols = frame->cols;
+}
+
+static void frame_clear_row(RenderBackend* backend, int y) {
+    Framebuffer* frame = (Framebuffer*)backend;
+    if (y < 0 || y >= frame->rows) return;
+
+    FrameCell* row = frame->cells + (size_t)y * frame->cols;
+    for (int x = 0; x < frame->cols; x++) {
+        row[x].ch = ' ';
+        row[x].attr = RENDER_TEXT;
+    }
+    frame->rows_cleared++;
+}
+
+static void frame_put_text(RenderBackend* backend, int y, int x, const char* text, size_t length, RenderAttr attr) {
+    Framebuffer* frame = (Framebuffer*)backend;
+    if (y < 0 || y >= frame->rows || x < 0 || x >= frame->cols) return;
+
+    if (length > (size_t)(frame->cols - x)) {
+        length = (size_t)(frame->cols - x);
+    }
+    FrameCell* cell = frame->cells + (size_t)y * frame->cols + x;
+    for (size_t i = 0; i < length; i++) {
+        cell[i].ch = text[i];
+        cell[i].attr = (unsigned char)attr;
+    }
+    frame->cells_written += length;
+}
+
+static void frame_get_cursor(RenderBackend* backend, int* y, int* x) {
+    Framebuffer* frame = (Framebuffer*)backend;
+    *y = frame->cursor_y;
+    *x = frame->cursor_x;
+}
+
+static void frame_move_cursor(RenderBackend* backend, int y, int x) {
+    Framebuffer* frame = (Framebuffer*)backend;
+    frame->cursor_y = y;
+    frame->cursor_x = x;
+}
+
+static void frame_present(RenderBackend* backend) {
+    ((Framebuffer*)backend)->frames++;
+}
+
+Framebuffer* create_framebuffer(int rows, int cols) {
+    Framebuffer* frame = (Framebuffer*)calloc(1, sizeof(Framebuffer));
+    if (!frame) {
+        perror("Failed to allocate memory for framebuffer");
+        return NULL;
+    }
+
+    frame->cells = (FrameCell*)malloc((size_t)rows * cols * sizeof(FrameCell));
+    if (!frame->cells) {
+        perror("Failed to allocate framebuffer cells");
+        free(frame);
+        return NULL;
+    }
+
+    frame->base.get_size = frame_get_size;
+    frame->base.clear_row = frame_clear_row;
+    frame->base.put_text = frame_put_text;
+    frame->base.get_cursor = frame_get_cursor;
+    frame->base.move_cursor = frame_move_cursor;
+    frame->base.present = frame_present;
+    frame->rows = rows;
+    frame->cols = cols;
+    for (int y = 0; y < rows; y++) {
+        frame_clear_row(&frame->base, y);
+    }
+    reset_framebuffer_counters(frame);
+
+    return frame;
+}
+
+void free_framebuffer(Framebuffer* frame) {
+    if (!frame) return;
+    free(frame->cells);
+    free(frame);
+}
+
+void reset_framebuffer_counters(Framebuffer* frame) {
+    frame->cells_written = 0;
+    frame->rows_cleared = 0;
+    frame->frames = 0;
+}
+
+static RenderBackend* active = &ncurses;
+
+void set_render_backend(RenderBackend* backend) {
+    active = backend ? backend : &ncurses;
+}
+
+RenderBackend* render_backend(void) {
+    return active;
+}
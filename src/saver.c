@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "saver.h"
+#include "piece_table.h"
+
+static void report_progress(void* context, size_t written, size_t total) {
+    Saver* saver = (Saver*)context;
+
+    pthread_mutex_lock(&saver->lock);
+    saver->written = written;
+    saver->total = total;
+    if (written == total) {
+        /* Everything has been handed to the kernel. */
+        saver->in_place = 0;
+        pthread_cond_broadcast(&saver->wake);
+    } else if (saver->in_place && saver->unshare_pending) {
+        saver->parked = 1;
+        pthread_cond_broadcast(&saver->wake);
+        while (saver->parked) {
+            pthread_cond_wait(&saver->wake, &saver->lock);
+        }
+    }
+    pthread_mutex_unlock(&saver->lock);
+}
+
+static void* save_worker(void* arg) {
+    Saver* saver = (Saver*)arg;
+
+    pthread_mutex_lock(&saver->lock);
+    for (;;) {
+        while (saver->state != SAVE_RUNNING && !saver->stop) {
+            pthread_cond_wait(&saver->wake, &saver->lock);
+        }
+        if (saver->state != SAVE_RUNNING) {
+            break;
+        }
+        pthread_mutex_unlock(&saver->lock);
+
+        int result = save_segments_to_file(saver->filename, saver->segments, saver->segment_count,
+                                           report_progress, saver);
+
+        pthread_mutex_lock(&saver->lock);
+        saver->result = result;
+        saver->in_place = 0;
+        saver->state = SAVE_DONE;
+        pthread_cond_broadcast(&saver->wake);
+    }
+    pthread_mutex_unlock(&saver->lock);
+
+    return NULL;
+}
+
+Saver* create_saver(const char* filename) {
+    Saver* saver = (Saver*)calloc(1, sizeof(Saver));
+    if (!saver) {
+        perror("Failed to allocate memory for saver");
+        return NULL;
+    }
+
+    snprintf(saver->filename, sizeof(saver->filename), "%s", filename);
+    saver->state = SAVE_IDLE;
+    pthread_mutex_init(&saver->lock, NULL);
+    pthread_cond_init(&saver->wake, NULL);
+
+    if (pthread_create(&saver->thread, NULL, save_worker, saver) != 0) {
+        perror("Error starting save thread");
+        pthread_mutex_destroy(&saver->lock);
+        pthread_cond_destroy(&saver->wake);
+        free(saver);
+        return NULL;
+    }
+
+    return saver;
+}
+
+/* Makes room for length bytes of copied text and count segments. */
+static int reserve_snapshot(Saver* saver, size_t length, size_t count) {
+    if (length > saver->snapshot_capacity) {
+        char* grown = (char*)realloc(saver->snapshot, length);
+        if (!grown) {
+            perror("Failed to allocate save snapshot");
+            return -1;
+        }
+        saver->snapshot = grown;
+        saver->snapshot_capacity = length;
+    }
+    if (count > saver->segment_capacity) {
+        struct iovec* grown = (struct iovec*)realloc(saver->segments, count * sizeof(struct iovec));
+        if (!grown) {
+            perror("Failed to allocate save segments");
+            return -1;
+        }
+        saver->segments = grown;
+        saver->segment_capacity = count;
+    }
+    return 0;
+}
+
+/* The buffer's unshare hook: the input thread is about to change bytes the
+ * running save still writes from. Waits until the worker is between
+ * chunks, then copies the text out and points the segments at the copy;
+ * without memory for that, waits for the save to finish instead. */
+static void unshare_snapshot(void* context) {
+    Saver* saver = (Saver*)context;
+    saver->shared = NULL;
+
+    pthread_mutex_lock(&saver->lock);
+    saver->unshare_pending = 1;
+    while (saver->in_place && !saver->parked) {
+        pthread_cond_wait(&saver->wake, &saver->lock);
+    }
+    if (saver->in_place) {
+        size_t head = saver->segments[0].iov_len;
+        size_t tail = saver->segments[1].iov_len;
+        if (reserve_snapshot(saver, head + tail, 2) == 0) {
+            memcpy(saver->snapshot, saver->segments[0].iov_base, head);
+            memcpy(saver->snapshot + head, saver->segments[1].iov_base, tail);
+            saver->segments[0].iov_base = saver->snapshot;
+            saver->segments[1].iov_base = saver->snapshot + head;
+            saver->in_place = 0;
+        }
+    }
+    saver->unshare_pending = 0;
+    saver->parked = 0;
+    pthread_cond_broadcast(&saver->wake);
+    while (saver->in_place) {
+        pthread_cond_wait(&saver->wake, &saver->lock);
+    }
+    pthread_mutex_unlock(&saver->lock);
+}
+
+/* Detaches the saver from the buffer once the worker no longer reads it. */
+static void release_shared(Saver* saver) {
+    if (saver->shared) {
+        saver->shared->unshare = NULL;
+        saver->shared = NULL;
+    }
+}
+
+int request_save(Saver* saver, Buffer* buf) {
+    pthread_mutex_lock(&saver->lock);
+    if (saver->state != SAVE_IDLE) {
+        saver->follow_up = 1;
+        pthread_mutex_unlock(&saver->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&saver->lock);
+
+    /* The worker is idle, so the snapshot can be refilled without the lock. */
+    if (buf->pieces) {
+        size_t count = buf->pieces->piece_count ? buf->pieces->piece_count : 1;
+        if (reserve_snapshot(saver, buf->pieces->add_size, count) < 0) return -1;
+        saver->segment_count = piece_table_snapshot(buf->pieces, saver->segments, saver->snapshot);
+    } else {
+        if (reserve_snapshot(saver, 0, 2) < 0) return -1;
+        saver->segments[0].iov_base = buf->buffer;
+        saver->segments[0].iov_len = buf->gap_start;
+        saver->segments[1].iov_base = buf->buffer + buf->gap_end;
+        saver->segments[1].iov_len = buf->buffer_size - buf->gap_end;
+        saver->segment_count = 2;
+        saver->shared = buf;
+        buf->unshare = unshare_snapshot;
+        buf->unshare_context = saver;
+        buf->shared_start = buf->gap_start;
+        buf->shared_end = buf->gap_end;
+    }
+    saver->generation = buf->generation;
+
+    pthread_mutex_lock(&saver->lock);
+    saver->in_place = saver->shared != NULL;
+    saver->written = 0;
+    saver->total = buf->text_size;
+    saver->follow_up = 0;
+    saver->state = SAVE_RUNNING;
+    pthread_cond_broadcast(&saver->wake);
+    pthread_mutex_unlock(&saver->lock);
+
+    return 1;
+}
+
+SaveState poll_save(Saver* saver, size_t* written, size_t* total, int* result, int* follow_up) {
+    pthread_mutex_lock(&saver->lock);
+
+    SaveState state = saver->state;
+    *written = saver->written;
+    *total = saver->total;
+    *result = saver->result;
+    *follow_up = saver->follow_up;
+
+    if (state == SAVE_DONE) {
+        saver->state = SAVE_IDLE;
+        saver->follow_up = 0;
+    }
+
+    pthread_mutex_unlock(&saver->lock);
+    if (state == SAVE_DONE) {
+        release_shared(saver);
+    }
+    return state;
+}
+
+void free_saver(Saver* saver) {
+    if (!saver) return;
+
+    pthread_mutex_lock(&saver->lock);
+    while (saver->state == SAVE_RUNNING) {
+        pthread_cond_wait(&saver->wake, &saver->lock);
+    }
+    saver->stop = 1;
+    pthread_cond_broadcast(&saver->wake);
+    pthread_mutex_unlock(&saver->lock);
+    pthread_join(saver->thread, NULL);
+    release_shared(saver);
+
+    pthread_mutex_destroy(&saver->lock);
+    pthread_cond_destroy(&saver->wake);
+    free(saver->snapshot);
+    free(saver->segments);
+    free(saver);
+}
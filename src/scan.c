@@ -0,0 +1,303 @@
+#include <stdint.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* Separators match isspace() in the C locale; blanks match the status
+ * bar's notion of characters that don't count. */
+static int is_separator(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int is_blank(unsigned char c) {
+    return c == ' ' || c == '\n' || c == '\t';
+}
+
+static size_t count_newlines_scalar(const char* text, size_t length) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            count++;
+        }
+    }
+    return count;
+}
+
+static size_t count_non_blank_scalar(const char* text, size_t length) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (!is_blank((unsigned char)text[i])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static size_t count_word_starts_scalar(const char* text, size_t length, int in_word) {
+    size_t starts = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (is_separator((unsigned char)text[i])) {
+            in_word = 0;
+        } else if (!in_word) {
+            in_word = 1;
+            starts++;
+        }
+    }
+    return starts;
+}
+
+static size_t newline_positions_scalar(const char* text, size_t length, size_t base, size_t* out) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            out[count++] = base + i;
+        }
+    }
+    return count;
+}
+
+#ifdef SCAN_X86
+
+/* Each kernel handles whole 16- or 32-byte blocks and hands the tail to the
+ * scalar loop. Masks are one bit per byte, as produced by movemask. */
+
+static inline __m128i separator_mask_sse2(__m128i bytes) {
+    __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+    __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8('\r' - '\t')), shifted);
+    return _mm_or_si128(control, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')));
+}
+
+static inline __m128i blank_mask_sse2(__m128i bytes) {
+    __m128i mask = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+    return _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t')));
+}
+
+static size_t count_newlines_sse2(const char* text, size_t length) {
+    size_t count = 0;
+    size_t i = 0;
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(text + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+    }
+    return count + count_newlines_scalar(text + i, length - i);
+}
+
+static size_t count_non_blank_sse2(const char* text, size_t length) {
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(text + i));
+        count += 16 - __builtin_popcount(_mm_movemask_epi8(blank_mask_sse2(bytes)));
+    }
+    return count + count_non_blank_scalar(text + i, length - i);
+}
+
+static size_t count_word_starts_sse2(const char* text, size_t length, int in_word) {
+    size_t starts = 0;
+    size_t i = 0;
+    uint32_t previous_separator = in_word ? 0 : 1;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(text + i));
+        uint32_t separators = (uint32_t)_mm_movemask_epi8(separator_mask_sse2(bytes));
+        uint32_t word_bytes = ~separators & 0xFFFFu;
+        starts += __builtin_popcount(word_bytes & ((separators << 1) | previous_separator));
+        previous_separator = (separators >> 15) & 1;
+    }
+    return starts + count_word_starts_scalar(text + i, length - i, !previous_separator);
+}
+
+static size_t newline_positions_sse2(const char* text, size_t length, size_t base, size_t* out) {
+    size_t count = 0;
+    size_t i = 0;
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(text + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+        while (mask) {
+            out[count++] = base + i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return count + newline_positions_scalar(text + i, length - i, base + i, out + count);
+}
+
+__attribute__((target("avx2,popcnt,bmi")))
+static inline __m256i separator_mask_avx2(__m256i bytes) {
+    __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+    __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8('\r' - '\t')), shifted);
+    return _mm256_or_si256(control, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')));
+}
+
+__attribute__((target("avx2,popcnt,bmi")))
+static inline __m256i blank_mask_avx2(__m256i bytes) {
+    __m256i mask = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+    mask = _mm256_or_si256(mask, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')));
+    return _mm256_or_si256(mask, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t')));
+}
+
+__attribute__((target("avx2,popcnt,bmi")))
+static size_t count_newlines_avx2(const char* text, size_t length) {
+    size_t count = 0;
+    size_t i = 0;
+    const __m256i newline = _mm256_set1_epi8('\n');
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(text + i));
+        count += _mm_popcnt_u32((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline)));
+    }
+    return count + count_newlines_sse2(text + i, length - i);
+}
+
+__attribute__((target("avx2,popcnt,bmi")))
+static size_t count_non_blank_avx2(const char* text, size_t length) {
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(text + i));
+        count += 32 - _mm_popcnt_u32((uint32_t)_mm256_movemask_epi8(blank_mask_avx2(bytes)));
+    }
+    return count + count_non_blank_sse2(text + i, length - i);
+}
+
+__attribute__((target("avx2,popcnt,bmi")))
+static size_t count_word_starts_avx2(const char* text, size_t length, int in_word) {
+    size_t starts = 0;
+    size_t i = 0;
+    uint64_t previous_separator = in_word ? 0 : 1;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(text + i));
+        uint64_t separators = (uint32_t)_mm256_movemask_epi8(separator_mask_avx2(bytes));
+        uint64_t word_bytes = ~separators & 0xFFFFFFFFu;
+        starts += _mm_popcnt_u64(word_bytes & ((separators << 1) | previous_separator));
+        previous_separator = (separators >> 31) & 1;
+    }
+    return starts + count_word_starts_sse2(text + i, length - i, !previous_separator);
+}
+
+__attribute__((target("avx2,popcnt,bmi")))
+static size_t newline_positions_avx2(const char* text, size_t length, size_t base, size_t* out) {
+    size_t count = 0;
+    size_t i = 0;
+    const __m256i newline = _mm256_set1_epi8('\n');
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(text + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline));
+        while (mask) {
+            out[count++] = base + i + _tzcnt_u32(mask);
+            mask = _blsr_u32(mask);
+        }
+    }
+    return count + newline_positions_sse2(text + i, length - i, base + i, out + count);
+}
+
+#endif
+
+typedef struct {
+    size_t (*count_newlines)(const char*, size_t);
+    size_t (*count_non_blank)(const char*, size_t);
+    size_t (*count_word_starts)(const char*, size_t, int);
+    size_t (*newline_positions)(const char*, size_t, size_t, size_t*);
+} ScanKernels;
+
+static const ScanKernels scalar_kernels = {
+    count_newlines_scalar, count_non_blank_scalar, count_word_starts_scalar, newline_positions_scalar
+};
+
+#ifdef SCAN_X86
+static const ScanKernels sse2_kernels = {
+    count_newlines_sse2, count_non_blank_sse2, count_word_starts_sse2, newline_positions_sse2
+};
+
+static const ScanKernels avx2_kernels = {
+    count_newlines_avx2, count_non_blank_avx2, count_word_starts_avx2, newline_positions_avx2
+};
+#endif
+
+static const ScanKernels* active_kernels = NULL;
+static ScanLevel active_level = SCAN_SCALAR;
+
+static ScanLevel best_supported_level(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("bmi")) {
+        return SCAN_AVX2;
+    }
+#if defined(__x86_64__) || defined(__SSE2__)
+    return SCAN_SSE2;
+#endif
+#endif
+    return SCAN_SCALAR;
+}
+
+ScanLevel scan_use_level(ScanLevel level) {
+    ScanLevel best = best_supported_level();
+    if (level > best) {
+        level = best;
+    }
+
+    switch (level) {
+#ifdef SCAN_X86
+        case SCAN_AVX2:
+            active_kernels = &avx2_kernels;
+            break;
+        case SCAN_SSE2:
+            active_kernels = &sse2_kernels;
+            break;
+#endif
+        default:
+            level = SCAN_SCALAR;
+            active_kernels = &scalar_kernels;
+            break;
+    }
+
+    active_level = level;
+    return level;
+}
+
+static const ScanKernels* kernels(void) {
+    if (!active_kernels) {
+        scan_use_level(SCAN_AVX2);
+    }
+    return active_kernels;
+}
+
+ScanLevel scan_level(void) {
+    kernels();
+    return active_level;
+}
+
+const char* scan_level_name(ScanLevel level) {
+    switch (level) {
+        case SCAN_AVX2: return "avx2";
+        case SCAN_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+size_t scan_count_newlines(const char* text, size_t length) {
+    return kernels()->count_newlines(text, length);
+}
+
+size_t scan_count_non_blank(const char* text, size_t length) {
+    return kernels()->count_non_blank(text, length);
+}
+
+size_t scan_count_word_starts(const char* text, size_t length, int in_word) {
+    return kernels()->count_word_starts(text, length, in_word);
+}
+
+size_t scan_newline_positions(const char* text, size_t length, size_t base, size_t* out) {
+    return kernels()->newline_positions(text, length, base, out);
+}
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include "search.h"
+
+void compile_search_pattern(SearchPattern* pattern, const char* text, size_t length) {
+    if (length > SEARCH_MAX_PATTERN) {
+        length = SEARCH_MAX_PATTERN;
+    }
+    memcpy(pattern->text, text, length);
+    pattern->length = length;
+
+    for (size_t c = 0; c < 256; c++) {
+        pattern->shift[c] = length ? length : 1;
+        pattern->back_shift[c] = length ? length : 1;
+    }
+    /* Forward: how far the last occurrence of a byte (other than in the
+     * final slot) is from the end. Backward: how far its first occurrence
+     * (other than in the first slot) is from the start. */
+    for (size_t i = 0; i + 1 < length; i++) {
+        pattern->shift[(unsigned char)text[i]] = length - 1 - i;
+    }
+    for (size_t i = length; i-- > 1;) {
+        pattern->back_shift[(unsigned char)text[i]] = i;
+    }
+}
+
+const char* search_memory(const SearchPattern* pattern, const char* text, size_t length) {
+    size_t m = pattern->length;
+    if (m == 0 || length < m) return NULL;
+
+    unsigned char first = (unsigned char)pattern->text[0];
+    unsigned char last = (unsigned char)pattern->text[m - 1];
+    const char* end = text + length - m + 1;
+    const char* at = text;
+    while (at < end) {
+        at = (const char*)memchr(at, first, (size_t)(end - at));
+        if (!at) return NULL;
+
+        unsigned char tail = (unsigned char)at[m - 1];
+        if (tail == last && memcmp(at + 1, pattern->text + 1, m - 1) == 0) {
+            return at;
+        }
+        at += pattern->shift[tail];
+    }
+    return NULL;
+}
+
+/* Last match wholly inside text: the mirror image of search_memory, with
+ * memrchr on the last byte and shifts keyed by the window's first byte. */
+static const char* search_memory_backward(const SearchPattern* pattern, const char* text, size_t length) {
+    size_t m = pattern->length;
+    if (m == 0 || length < m) return NULL;
+
+    unsigned char first = (unsigned char)pattern->text[0];
+    unsigned char last = (unsigned char)pattern->text[m - 1];
+    size_t starts = length - m + 1;
+    while (starts > 0) {
+        const char* tail = (const char*)memrchr(text + m - 1, last, starts);
+        if (!tail) return NULL;
+
+        const char* at = tail - (m - 1);
+        if ((unsigned char)at[0] == first && memcmp(at, pattern->text, m - 1) == 0) {
+            return at;
+        }
+
+        size_t skip = pattern->back_shift[(unsigned char)at[0]];
+        size_t index = (size_t)(at - text);
+        if (index < skip) return NULL;
+        starts = index - skip + 1;
+    }
+    return NULL;
+}
+
+int search_forward(Buffer* buf, const SearchPattern* pattern, size_t from, size_t* match) {
+    size_t m = pattern->length;
+    char seam[2 * SEARCH_MAX_PATTERN];
+    if (m == 0) return 0;
+
+    for (size_t position = from, length; position + m <= buf->text_size; position += length) {
+        length = buf->text_size - position;
+        const char* chunk = buffer_chunk(buf, position, &length);
+        if (!chunk) break;
+
+        const char* found = search_memory(pattern, chunk, length);
+        if (found) {
+            *match = position + (size_t)(found - chunk);
+            return 1;
+        }
+
+        /* A match may start in the last m - 1 bytes and run on into the
+         * next chunk; any such match lies in this window. */
+        size_t end = position + length;
+        if (m > 1 && end < buf->text_size) {
+            size_t start = length > m - 1 ? end - (m - 1) : position;
+            size_t stop = buf->text_size - end > m - 1 ? end + (m - 1) : buf->text_size;
+            size_t copied = read_range(buf, start, stop - start, seam);
+            found = search_memory(pattern, seam, copied);
+            if (found) {
+                *match = start + (size_t)(found - seam);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int search_backward(Buffer* buf, const SearchPattern* pattern, size_t from, size_t* match) {
+    size_t m = pattern->length;
+    char seam[2 * SEARCH_MAX_PATTERN];
+    if (m == 0 || buf->text_size < m) return 0;
+
+    /* Matches starting at or before from end by from + m. */
+    size_t limit = buf->text_size - m < from ? buf->text_size : from + m;
+    for (size_t end = limit, length; end >= m; end -= length) {
+        length = end;
+        const char* chunk = buffer_chunk_before(buf, end, &length);
+        if (!chunk) break;
+
+        const char* found = search_memory_backward(pattern, chunk, length);
+        if (found) {
+            *match = end - length + (size_t)(found - chunk);
+            return 1;
+        }
+
+        size_t start = end - length;
+        if (m > 1 && start > 0) {
+            size_t window_start = start > m - 1 ? start - (m - 1) : 0;
+            size_t window_end = limit - start > m - 1 ? start + (m - 1) : limit;
+            size_t copied = read_range(buf, window_start, window_end - window_start, seam);
+            found = search_memory_backward(pattern, seam, copied);
+            if (found) {
+                *match = window_start + (size_t)(found - seam);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -1,417 +1,434 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <ctype.h>
-#include <ncurses.h>
 #include "utils.h"
 #include "buffer.h"
+#include "render.h"
+#include "search.h"
 
 #define LINE_NUMBER_WIDTH 4
 
-void display_line_number(size_t line_number, size_t y_pos) {
-    char line_num_str[10];
-    sprintf(line_num_str, "%3zu", line_number + 1);
+/* The gutter fits the largest line number the window can show, so it only
+ * changes when the window scrolls, and every x position is recomputed
+ * then anyway. */
+size_t line_number_width(Buffer* buf) {
+    int rows, cols;
+    render_backend()->get_size(render_backend(), &rows, &cols);
+    (void)cols;
+
+    size_t last = buf->first_line + TEXT_AREA_HEIGHT((size_t)rows);
+    size_t digits = 1;
+    while (last >= 10) {
+        last /= 10;
+        digits++;
+    }
+    return digits + 1 > LINE_NUMBER_WIDTH ? digits + 1 : LINE_NUMBER_WIDTH;
+}
+
+void display_line_number(Buffer* buf, size_t line_number, size_t y_pos) {
+    char line_num_str[24];
+    int length = snprintf(line_num_str, sizeof(line_num_str), "%*zu",
+                          (int)line_number_width(buf) - 1, line_number + 1);
     
-    attron(A_DIM);
-    mvprintw(y_pos, 0, "%s", line_num_str);
-    attroff(A_DIM);
+    RenderBackend* backend = render_backend();
+    backend->put_text(backend, (int)y_pos, 0, line_num_str, (size_t)length, RENDER_DIM);
 }
 
-cursor initial_buffer_render_on_window(Buffer* buf, size_t width, size_t height) {
-    cursor coordinates;
+size_t get_buffer_position(Buffer* buf, size_t x_pos, size_t y_pos) {
+    size_t column = buf->first_column + (x_pos - 1 - line_number_width(buf));
+    return buffer_position_of(buf, buf->first_line + y_pos, column);
+}
 
-    if (!buf) {
-        coordinates.status = -1;
-        return coordinates;
-    }    
+int scroll_to_position(Buffer* buf, size_t position, size_t* x_pos, size_t* y_pos, size_t width) {
+    int rows, cols;
+    render_backend()->get_size(render_backend(), &rows, &cols);
+    (void)cols;
 
-    size_t Y_POS = 0;
-    size_t X_POS = 1;
-    size_t end_of_screen = height * (width - 2);
+    size_t text_rows = TEXT_AREA_HEIGHT((size_t)rows);
+    size_t line = buffer_line_of_position(buf, position);
+    size_t column = position - buffer_line_start(buf, line);
+    int scrolled = 0;
 
-    buf->first_character = 0;
-    buf->last_character = 0;
+    if (line < buf->first_line) {
+        buf->first_line = line;
+        scrolled = 1;
+    } else if (line >= buf->first_line + text_rows) {
+        buf->first_line = line - text_rows + 1;
+        scrolled = 1;
+    }
 
-    clear();
+    /* The gutter, and so the text width, follows the new first line. */
+    size_t text_cols = TEXT_AREA_WIDTH(buf, width);
+    if (column < buf->first_column) {
+        buf->first_column = column;
+        scrolled = 1;
+    } else if (column >= buf->first_column + text_cols) {
+        buf->first_column = column - text_cols + 1;
+        scrolled = 1;
+    }
 
-    display_line_number(Y_POS, Y_POS);
+    *y_pos = line - buf->first_line;
+    *x_pos = (column - buf->first_column) + 1 + line_number_width(buf);
+    return scrolled;
+}
 
-    for (size_t index = 0; index < buf->gap_start; index++) {
-        if ((X_POS - 1) + Y_POS * (width - 2) >= end_of_screen) {
-            buf->last_character = index;
-            break;
-        }
+/* Puts the cursor on position. A target off screen is brought to the
+ * middle of the window (or as near as the end of the text allows), so
+ * only the destination screen is drawn, however far away it is. */
+void jump_to_position(Buffer* buf, size_t position, size_t* x_pos, size_t* y_pos, size_t width) {
+    RenderBackend* backend = render_backend();
+    int rows, cols;
+    backend->get_size(backend, &rows, &cols);
+    (void)cols;
 
-        if (X_POS >= width - 1) {
-            X_POS = 1;
-            Y_POS++;
-            
-            display_line_number(Y_POS, Y_POS);
-            
-            if (Y_POS >= height) {
-                buf->last_character = index;
-                break;
-            }
+    size_t text_rows = TEXT_AREA_HEIGHT((size_t)rows);
+    size_t line = buffer_line_of_position(buf, position);
+    if (line < buf->first_line || line >= buf->first_line + text_rows) {
+        size_t line_count = buffer_line_count(buf);
+        size_t last_first = line_count > text_rows ? line_count - text_rows : 0;
+        buf->first_line = line > text_rows / 2 ? line - text_rows / 2 : 0;
+        if (buf->first_line > last_first) {
+            buf->first_line = last_first;
         }
-        
-        mvaddch(Y_POS, X_POS + LINE_NUMBER_WIDTH, buf->buffer[index]);
-        X_POS++;
     }
 
-    if (Y_POS < height) {
-        for (size_t i = 0; i < (buf->text_size - buf->gap_start); i++) {
-            size_t index = buf->gap_end + i;
-            
-            if (index >= buf->buffer_size || 
-                (X_POS - 1) + Y_POS * (width - 2) >= end_of_screen) {
-                break;
-            }
+    scroll_to_position(buf, position, x_pos, y_pos, width);
+    redraw_window(buf, width);
+    backend->move_cursor(backend, (int)*y_pos, (int)*x_pos);
+    backend->present(backend);
+}
 
-            if (X_POS >= width - 1) {
-                X_POS = 1;
-                Y_POS++;
-                
-                display_line_number(Y_POS, Y_POS);
-                
-                if (Y_POS >= height) {
-                    break;
-                }
-            }
-            
-            mvaddch(Y_POS, X_POS + LINE_NUMBER_WIDTH, buf->buffer[index]);
-            X_POS++;
+/* Scrolls a screen up (direction < 0) or down, keeping the cursor on the
+ * same row and column; at either end the cursor goes to the first or last
+ * line instead. */
+void scroll_page(Buffer* buf, int direction, size_t* x_pos, size_t* y_pos, size_t width) {
+    RenderBackend* backend = render_backend();
+    int rows, cols;
+    backend->get_size(backend, &rows, &cols);
+    (void)cols;
+
+    size_t text_rows = TEXT_AREA_HEIGHT((size_t)rows);
+    size_t line = buf->first_line + *y_pos;
+    size_t column = buf->first_column + (*x_pos - 1 - line_number_width(buf));
+
+    if (direction < 0) {
+        size_t step = buf->first_line < text_rows ? buf->first_line : text_rows;
+        if (step == 0) {
+            line = 0;
+        }
+        buf->first_line -= step;
+        line -= step;
+    } else {
+        size_t line_count = buffer_line_count(buf);
+        size_t last_first = line_count > text_rows ? line_count - text_rows : 0;
+        size_t step = last_first > buf->first_line ? last_first - buf->first_line : 0;
+        if (step > text_rows) {
+            step = text_rows;
         }
+        if (step == 0) {
+            line = line_count - 1;
+        }
+        buf->first_line += step;
+        line += step;
+    }
+
+    scroll_to_position(buf, buffer_position_of(buf, line, column), x_pos, y_pos, width);
+    redraw_window(buf, width);
+    backend->move_cursor(backend, (int)*y_pos, (int)*x_pos);
+    backend->present(backend);
+}
+
+cursor initial_buffer_render_on_window(Buffer* buf, size_t width, size_t height) {
+    cursor coordinates;
+
+    if (!buf) {
+        coordinates.status = -1;
+        return coordinates;
+    }    
+
+    buf->first_line = 0;
+    buf->first_column = 0;
+
+    invalidate_window();
+    redraw_window(buf, width);
+
+    size_t last_line = buffer_line_count(buf) - 1;
+    if (last_line >= TEXT_AREA_HEIGHT(height)) {
+        last_line = TEXT_AREA_HEIGHT(height) - 1;
+    }
+
+    size_t X_POS = buffer_line_length(buf, last_line) + 1;
+    if (X_POS > TEXT_AREA_WIDTH(buf, width)) {
+        X_POS = TEXT_AREA_WIDTH(buf, width);
     }
 
     coordinates.initial_x_pos = X_POS;
-    coordinates.initial_y_pos = Y_POS;
+    coordinates.initial_y_pos = last_line;
     coordinates.status = 0;
-
-    refresh();
     
     return coordinates;
 }
 
-void redraw_window(Buffer* buf, size_t width) {
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);
-    
-    size_t edit_area_height = (size_t)(rows - 2);
-    
-    clear();
-    size_t Y_POS = 0;
-    size_t X_POS = 1;
-    size_t displayed_chars = 0;
-    
-    display_line_number(Y_POS, Y_POS);
-    
-    for (size_t i = buf->first_character; i < buf->gap_start; i++) {
-        if (X_POS >= width - 1) {
-            X_POS = 1;
-            Y_POS++;
-            
-            if (Y_POS >= edit_area_height) {
-                break;
-            }
-            
-            display_line_number(Y_POS, Y_POS);
-        }
-        
-        int color = COLOR_PAIR(1);
-        
-        attron(color);
-        mvaddch(Y_POS, X_POS + LINE_NUMBER_WIDTH, buf->buffer[i]);
-        attroff(color);
-        X_POS++;
-        displayed_chars++;
+/* What the screen currently shows, so redraw_window can repaint only the
+ * rows touched since the last frame. */
+static size_t drawn_first_line = (size_t)-1;
+static size_t drawn_first_column = 0;
+static size_t drawn_rows = 0;
+static size_t drawn_width = 0;
+
+void invalidate_window(void) {
+    drawn_first_line = (size_t)-1;
+}
+
+static char text_cell(char ch) {
+    unsigned char byte = (unsigned char)ch;
+    if (byte == '\t') {
+        byte = ' ';
+    } else if (byte < 32 || byte == 127) {
+        byte = '?';
     }
+    return (char)byte;
+}
 
-    size_t chars_after_gap = buf->text_size - buf->gap_start;
-    for (size_t i = 0; i < chars_after_gap; i++) {
-        if (X_POS >= width - 1) {
-            X_POS = 1;
-            Y_POS++;
-            
-            if (Y_POS >= edit_area_height) {
-                break;
-            }
-            
-            display_line_number(Y_POS, Y_POS);
-        }
+static const SearchPattern* search_highlight = NULL;
 
-        size_t buffer_idx = buf->gap_end + i;
-        if (buffer_idx >= buf->buffer_size) {
-            break;
-        }
-        
-        int color = COLOR_PAIR(1);
-        
-        attron(color);
-        mvaddch(Y_POS, X_POS + LINE_NUMBER_WIDTH, buf->buffer[buffer_idx]);
-        attroff(color);
-        X_POS++;
-        displayed_chars++;
+/* Matches of pattern in the window are drawn reversed until the highlight
+ * is set back to NULL; the pattern must stay valid until then. */
+void set_search_highlight(const SearchPattern* pattern) {
+    search_highlight = pattern && pattern->length > 0 ? pattern : NULL;
+    invalidate_window();
+}
+
+/* Draws over the search matches on a row whose visible cells are in row.
+ * The line is searched from m - 1 bytes left of the window, so a match cut
+ * by the left edge is still shown. */
+static void highlight_matches(Buffer* buf, size_t y_pos, size_t line_start, size_t line_length,
+                              const char* row, size_t visible) {
+    static char* text = NULL;
+    static size_t text_capacity = 0;
+    RenderBackend* backend = render_backend();
+
+    size_t m = search_highlight->length;
+    size_t from = buf->first_column > m - 1 ? buf->first_column - (m - 1) : 0;
+    size_t to = buf->first_column + visible + (m - 1);
+    if (to > line_length) {
+        to = line_length;
     }
+    if (to - from < m) return;
 
-    if (Y_POS < (size_t)(rows - 3)) {
-        buf->last_character = buf->first_character + displayed_chars;
+    if (to - from > text_capacity) {
+        char* grown = (char*)realloc(text, to - from);
+        if (!grown) {
+            perror("Failed to allocate highlight buffer");
+            return;
+        }
+        text = grown;
+        text_capacity = to - from;
     }
 
-    refresh();
+    size_t length = read_range(buf, line_start + from, to - from, text);
+    size_t text_x = 1 + line_number_width(buf);
+    const char* at = text;
+    while ((at = search_memory(search_highlight, at, length - (size_t)(at - text))) != NULL) {
+        size_t start = from + (size_t)(at - text);
+        size_t end = start + m;
+        if (start < buf->first_column) {
+            start = buf->first_column;
+        }
+        if (end > buf->first_column + visible) {
+            end = buf->first_column + visible;
+        }
+        if (end > start) {
+            size_t offset = start - buf->first_column;
+            backend->put_text(backend, (int)y_pos, (int)(text_x + offset), row + offset, end - start, RENDER_REVERSE);
+        }
+        at += m;
+    }
 }
 
-void render_backspace_on_window(Buffer* buf, size_t x_pos, size_t y_pos, size_t width) {
-    if (x_pos <= 1 && y_pos <= 0 && buf->first_character == 0) {
+/* Builds the visible part of a line straight from the gap segments and
+ * hands it to the backend as a single run. */
+static void draw_row(Buffer* buf, size_t y_pos, size_t line, size_t text_cols) {
+    static char* row = NULL;
+    static size_t row_capacity = 0;
+    RenderBackend* backend = render_backend();
+
+    backend->clear_row(backend, (int)y_pos);
+
+    if (line >= buffer_line_count(buf)) {
         return;
     }
-    
-    size_t screen_index = (x_pos - 1) + y_pos * (width - 2);
-    size_t buffer_index = screen_index + buf->first_character;
-    
-    if (buffer_index == 0) {
+
+    display_line_number(buf, line, y_pos);
+
+    size_t length = buffer_line_length(buf, line);
+    if (length <= buf->first_column) {
         return;
     }
-    
-    if (x_pos == 1 && y_pos > 0) {
-        y_pos--;
-        x_pos = width - 1;
-        
-        screen_index = (x_pos - 1) + y_pos * (width - 2);
-        buffer_index = screen_index + buf->first_character;
-    }
-    
-    move_buffer_cursor(buf, buffer_index);
-    delete_buffer(buf);
-    
-    redraw_window(buf, width);
-    
-    if (x_pos > 1) {
-        x_pos--;
-    } else if (y_pos > 0) {
-        y_pos--;
-        x_pos = width - 1;
+
+    size_t visible = length - buf->first_column;
+    if (visible > text_cols) {
+        visible = text_cols;
     }
-    
-    move(y_pos, x_pos + LINE_NUMBER_WIDTH);
-    refresh();
-}
 
-void render_space_on_window(Buffer* buf, size_t *x_pos, size_t *y_pos, size_t width) {
-    size_t screen_index = (*x_pos - 1 - LINE_NUMBER_WIDTH) + *y_pos * (width - 2);
-    size_t buffer_index = screen_index + buf->first_character;
-    
-    if (buffer_index <= buf->text_size) {
-        move_buffer_cursor(buf, buffer_index);
-    } else {
-        move_buffer_cursor(buf, buf->text_size);
-        while (buf->text_size < buffer_index) {
-            insert_buffer(buf, ' ');
+    if (visible > row_capacity) {
+        char* grown = (char*)realloc(row, visible);
+        if (!grown) {
+            perror("Failed to allocate row buffer");
+            return;
         }
+        row = grown;
+        row_capacity = visible;
     }
-    
-    insert_buffer(buf, ' ');
 
-    redraw_window(buf, width);
+    size_t position = buffer_line_start(buf, line) + buf->first_column;
+    size_t filled = 0;
+    while (filled < visible) {
+        size_t chunk_length = visible - filled;
+        const char* chunk = buffer_chunk(buf, position + filled, &chunk_length);
+        if (!chunk) break;
+        for (size_t i = 0; i < chunk_length; i++) {
+            row[filled + i] = text_cell(chunk[i]);
+        }
+        filled += chunk_length;
+    }
 
-    (*x_pos)++;
-    if (*x_pos >= width - 1 + LINE_NUMBER_WIDTH) {
-        *x_pos = 1 + LINE_NUMBER_WIDTH;
-        (*y_pos)++;
+    backend->put_text(backend, (int)y_pos, 1 + (int)line_number_width(buf), row, filled, RENDER_TEXT);
+    if (search_highlight) {
+        highlight_matches(buf, y_pos, buffer_line_start(buf, line), length, row, filled);
     }
-    move(*y_pos, *x_pos);
-    refresh();
 }
 
-void render_enter_on_window(Buffer* buf, size_t *x_pos, size_t *y_pos, size_t width) {
-    size_t screen_index = (*x_pos - 1 - LINE_NUMBER_WIDTH) + *y_pos * (width - 2);
-    size_t curr_index = screen_index + buf->first_character;
-    
-    if (curr_index > buf->text_size) {
-        curr_index = buf->text_size;
-    }
-    
-    move_buffer_cursor(buf, curr_index);
-    
-    size_t content_after_size = buf->text_size - curr_index;
-    char* content_after = NULL;
+void redraw_window(Buffer* buf, size_t width) {
+    RenderBackend* backend = render_backend();
+    int rows, cols;
+    backend->get_size(backend, &rows, &cols);
+    (void)cols;
     
-    if (content_after_size > 0) {
-        content_after = malloc(content_after_size + 1);
-        if (!content_after) {
-            perror("Failed to allocate memory");
-            return;
-        }
-        
-        size_t idx = 0;
-        for (size_t i = curr_index; i < buf->text_size; i++) {
-            char ch;
-            if (i < buf->gap_start) {
-                ch = buf->buffer[i];
-            } else {
-                size_t adjusted_pos = buf->gap_end + (i - buf->gap_start);
-                ch = buf->buffer[adjusted_pos];
+    size_t edit_area_height = TEXT_AREA_HEIGHT((size_t)rows);
+    size_t text_cols = TEXT_AREA_WIDTH(buf, width);
+    size_t first_row = 0;
+    size_t end_row = edit_area_height;
+
+    int viewport_changed = drawn_first_line != buf->first_line ||
+                           drawn_first_column != buf->first_column ||
+                           drawn_rows != edit_area_height ||
+                           drawn_width != width;
+
+    if (!viewport_changed) {
+        if (buf->damage_start > buf->damage_end ||
+            buf->damage_start >= buf->first_line + edit_area_height ||
+            buf->damage_end < buf->first_line) {
+            end_row = 0;
+        } else {
+            if (buf->damage_start > buf->first_line) {
+                first_row = buf->damage_start - buf->first_line;
+            }
+            if (buf->damage_end < buf->first_line + edit_area_height) {
+                end_row = buf->damage_end - buf->first_line + 1;
             }
-            content_after[idx++] = ch;
-        }
-        content_after[idx] = '\0';
-        
-        for (size_t i = 0; i < content_after_size; i++) {
-            move_buffer_cursor(buf, buf->text_size - 1);
-            delete_buffer(buf);
         }
     }
-    
-    size_t remain_on_line = (width - 2) - ((*x_pos - 1 - LINE_NUMBER_WIDTH));
-    for (size_t i = 0; i < remain_on_line; i++) {
-        insert_buffer(buf, ' ');
+
+    for (size_t Y_POS = first_row; Y_POS < end_row; Y_POS++) {
+        draw_row(buf, Y_POS, buf->first_line + Y_POS, text_cols);
     }
-    
-    (*y_pos)++;
-    *x_pos = 1 + LINE_NUMBER_WIDTH;
-    
-    display_line_number(*y_pos, *y_pos);
-    
-    if (content_after) {
-        for (size_t i = 0; i < content_after_size; i++) {
-            insert_buffer(buf, content_after[i]);
-        }
-        free(content_after);
+
+    buffer_clear_damage(buf);
+    drawn_first_line = buf->first_line;
+    drawn_first_column = buf->first_column;
+    drawn_rows = edit_area_height;
+    drawn_width = width;
+
+    size_t line_count = buffer_line_count(buf);
+    size_t last_line = buf->first_line + edit_area_height - 1;
+    if (last_line >= line_count) {
+        last_line = line_count - 1;
     }
-    
-    redraw_window(buf, width);
-    move(*y_pos, *x_pos);
-    refresh();
+    buf->first_character = buffer_line_start(buf, buf->first_line);
+    buf->last_character = buffer_line_start(buf, last_line) + buffer_line_length(buf, last_line);
+
+    backend->present(backend);
 }
 
-void update_general_window(Buffer* buf, size_t* x_pos, size_t* y_pos, int ch, size_t width) {
-    size_t screen_index = (*x_pos - 1 - LINE_NUMBER_WIDTH) + *y_pos * (width - 2);
-    size_t buffer_index = screen_index + buf->first_character;
+static void finish_edit(Buffer* buf, size_t position, size_t* x_pos, size_t* y_pos, size_t width) {
+    RenderBackend* backend = render_backend();
 
-    if (*x_pos >= width - 1 + LINE_NUMBER_WIDTH) {
-        *x_pos = 1 + LINE_NUMBER_WIDTH;
-        (*y_pos)++;
-    }
-    
-    if (buffer_index <= buf->text_size) {
-        move_buffer_cursor(buf, buffer_index);
-    } else {
-        move_buffer_cursor(buf, buf->text_size);
-        while (buf->text_size < buffer_index) {
-            insert_buffer(buf, ' ');
-        }
-    }
-    
-    insert_buffer(buf, ch);
-    
+    scroll_to_position(buf, position, x_pos, y_pos, width);
     redraw_window(buf, width);
-    
-    (*x_pos)++;
-    if (*x_pos >= width - 1 + LINE_NUMBER_WIDTH) {
-        *x_pos = 1 + LINE_NUMBER_WIDTH;
-        (*y_pos)++;
-    }
-    move(*y_pos, *x_pos);
-    refresh();
+    backend->move_cursor(backend, (int)*y_pos, (int)*x_pos);
+    backend->present(backend);
 }
 
-void render_delete_on_window(Buffer* buf, size_t x_pos, size_t y_pos, size_t width) {
-    size_t screen_index = (x_pos - 1 - LINE_NUMBER_WIDTH) + y_pos * (width - 2);
-    size_t buffer_index = screen_index + buf->first_character;
+void render_backspace_on_window(Buffer* buf, size_t* x_pos, size_t* y_pos, size_t width) {
+    size_t buffer_index = get_buffer_position(buf, *x_pos, *y_pos);
     
-    if (buffer_index >= buf->text_size) {
+    if (buffer_index == 0) {
         return;
     }
     
-    move_buffer_cursor(buf, buffer_index + 1);
+    move_buffer_cursor(buf, buffer_index);
     delete_buffer(buf);
     
-    redraw_window(buf, width);
-    
-    move(y_pos, x_pos);
-    refresh();
+    finish_edit(buf, buffer_index - 1, x_pos, y_pos, width);
 }
 
-size_t count_lines(Buffer* buf) {
-    if (!buf || buf->text_size == 0) return 0;
-    
-    size_t line_count = 1;
-    
-    for (size_t i = 0; i < buf->gap_start; i++) {
-        if (buf->buffer[i] == '\n') {
-            line_count++;
-        }
-    }
+void render_space_on_window(Buffer* buf, size_t *x_pos, size_t *y_pos, size_t width) {
+    update_general_window(buf, x_pos, y_pos, ' ', width);
+}
+
+void render_enter_on_window(Buffer* buf, size_t *x_pos, size_t *y_pos, size_t width) {
+    size_t curr_index = get_buffer_position(buf, *x_pos, *y_pos);
     
-    for (size_t i = buf->gap_end; i < buf->buffer_size && buf->buffer[i] != '\0'; i++) {
-        if (buf->buffer[i] == '\n') {
-            line_count++;
-        }
-    }
+    insert_string(buf, curr_index, "\n", 1);
     
-    return line_count;
+    finish_edit(buf, curr_index + 1, x_pos, y_pos, width);
 }
 
-size_t count_words(Buffer* buf) {
-    if (!buf || buf->text_size == 0) return 0;
-    
-    size_t word_count = 0;
-    int in_word = 0;
+void update_general_window(Buffer* buf, size_t* x_pos, size_t* y_pos, int ch, size_t width) {
+    size_t buffer_index = get_buffer_position(buf, *x_pos, *y_pos);
     
-    for (size_t i = 0; i < buf->gap_start; i++) {
-        char c = buf->buffer[i];
-        if (isspace(c) || c == '\n') {
-            in_word = 0;
-        } else if (!in_word) {
-            in_word = 1;
-            word_count++;
-        }
-    }
+    move_buffer_cursor(buf, buffer_index);
+    insert_buffer(buf, ch);
     
-    in_word = 0;
+    finish_edit(buf, buffer_index + 1, x_pos, y_pos, width);
+}
+
+void render_text_on_window(Buffer* buf, size_t* x_pos, size_t* y_pos, const char* text, size_t length, size_t width) {
+    size_t buffer_index = get_buffer_position(buf, *x_pos, *y_pos);
     
-    for (size_t i = buf->gap_end; i < buf->buffer_size && buf->buffer[i] != '\0'; i++) {
-        char c = buf->buffer[i];
-        if (isspace(c) || c == '\n') {
-            in_word = 0;
-        } else if (!in_word) {
-            in_word = 1;
-            word_count++;
-        }
-    }
+    insert_string(buf, buffer_index, text, length);
     
-    return word_count;
+    finish_edit(buf, buffer_index + length, x_pos, y_pos, width);
 }
 
-size_t count_non_space_chars(Buffer* buf) {
-    if (!buf || buf->text_size == 0) return 0;
-    
-    size_t char_count = 0;
+void render_delete_on_window(Buffer* buf, size_t x_pos, size_t y_pos, size_t width) {
+    size_t buffer_index = get_buffer_position(buf, x_pos, y_pos);
     
-    for (size_t i = 0; i < buf->gap_start; i++) {
-        if (buf->buffer[i] != ' ' && buf->buffer[i] != '\n' && buf->buffer[i] != '\t') {
-            char_count++;
-        }
+    if (buffer_index >= buf->text_size) {
+        return;
     }
     
-    for (size_t i = buf->gap_end; i < buf->buffer_size && buf->buffer[i] != '\0'; i++) {
-        if (buf->buffer[i] != ' ' && buf->buffer[i] != '\n' && buf->buffer[i] != '\t') {
-            char_count++;
-        }
-    }
+    delete_range(buf, buffer_index, 1);
+    
+    redraw_window(buf, width);
     
-    return char_count;
+    RenderBackend* backend = render_backend();
+    backend->move_cursor(backend, (int)y_pos, (int)x_pos);
+    backend->present(backend);
 }
 
 void display_status_bar(Buffer* buf, const char* filename, size_t x_pos, size_t y_pos) {
+    RenderBackend* backend = render_backend();
     int rows, cols;
-    getmaxyx(stdscr, rows, cols);
+    backend->get_size(backend, &rows, &cols);
     
     int cur_y, cur_x;
-    getyx(stdscr, cur_y, cur_x);
+    backend->get_cursor(backend, &cur_y, &cur_x);
     
-    size_t line_count = count_lines(buf);
-    size_t char_count = count_non_space_chars(buf);
-    size_t word_count = count_words(buf);
+    size_t line_count = buf->text_size > 0 ? buffer_line_count(buf) : 0;
+    size_t char_count = buf->non_space_count;
+    size_t word_count = buf->word_count;
     
     const char* short_filename = filename;
     const char* last_slash = strrchr(filename, '/');
@@ -422,17 +439,35 @@ void display_status_bar(Buffer* buf, const char* filename, size_t x_pos, size_t
     char status_left[64];
     char status_right[192];
     
-    snprintf(status_left, sizeof(status_left), " %s ", 
-             short_filename ? short_filename : "Untitled");
+    snprintf(status_left, sizeof(status_left), " %s%s ", 
+             short_filename ? short_filename : "Untitled",
+             buf->read_only ? " [view]" : buf->generation != buf->saved_generation ? " [+]" : "");
              
-    snprintf(status_right, sizeof(status_right), " UTF-8 | L: %zu | Ch: %zu | W: %zu | %zu:%zu ", 
-             line_count, 
-             char_count, 
-             word_count,
-             y_pos + 1, 
-             x_pos - LINE_NUMBER_WIDTH + 1);
-    
-    move(rows - 2, 0);
+    int lines_complete = buffer_lines_complete(buf);
+    if (buf->read_only || !lines_complete) {
+        /* Only the lines scanned so far are known until the background
+         * index is done, and a view never counts words, which would mean
+         * reading the whole file. */
+        snprintf(status_right, sizeof(status_right), " UTF-8 | L: %zu%s | %zu:%zu ", 
+                 line_count,
+                 lines_complete ? "" : "+",
+                 buf->first_line + y_pos + 1, 
+                 buf->first_column + x_pos - line_number_width(buf));
+    } else if (buffer_index_pending(buf)) {
+        /* The sparse scan can finish before the full index is taken up,
+         * and only that brings in the character and word totals. */
+        snprintf(status_right, sizeof(status_right), " UTF-8 | L: %zu | Ch: ... | W: ... | %zu:%zu ", 
+                 line_count,
+                 buf->first_line + y_pos + 1, 
+                 buf->first_column + x_pos - line_number_width(buf));
+    } else {
+        snprintf(status_right, sizeof(status_right), " UTF-8 | L: %zu | Ch: %zu | W: %zu | %zu:%zu ", 
+                 line_count, 
+                 char_count, 
+                 word_count,
+                 buf->first_line + y_pos + 1, 
+                 buf->first_column + x_pos - line_number_width(buf));
+    }
     
     size_t right_text_len = strlen(status_right);
     size_t left_text_len = strlen(status_left);
@@ -442,28 +477,28 @@ void display_status_bar(Buffer* buf, const char* filename, size_t x_pos, size_t
         right_start = left_text_len;
     }
     
-    for (int i = 0; i < cols; i++) {
-        mvaddch(rows - 2, i, ' ');
-    }
-    
-    static int colors_initialized = 0;
-    if (!colors_initialized) {
-        start_color();
-        init_pair(20, COLOR_BLACK, COLOR_WHITE);
-        init_pair(21, COLOR_BLACK, COLOR_WHITE);
-        colors_initialized = 1;
+    /* Compose the whole bar and draw it as one reversed run. */
+    static char* bar = NULL;
+    static size_t bar_capacity = 0;
+    if ((size_t)cols > bar_capacity) {
+        char* grown = (char*)realloc(bar, cols);
+        if (!grown) {
+            perror("Failed to allocate status bar");
+            return;
+        }
+        bar = grown;
+        bar_capacity = cols;
     }
     
-    attron(A_REVERSE);
-    mvprintw(rows - 2, 0, "%s", status_left);
-    
-    for (int i = left_text_len; i < right_start; i++) {
-        mvaddch(rows - 2, i, ' ');
+    memset(bar, ' ', cols);
+    memcpy(bar, status_left, left_text_len < (size_t)cols ? left_text_len : (size_t)cols);
+    if (right_start < cols) {
+        size_t room = cols - right_start;
+        memcpy(bar + right_start, status_right, right_text_len < room ? right_text_len : room);
     }
     
-    mvprintw(rows - 2, right_start, "%s", status_right);
-    attroff(A_REVERSE);
+    backend->put_text(backend, rows - 2, 0, bar, cols, RENDER_REVERSE);
     
-    move(cur_y, cur_x);
-    refresh();
+    backend->move_cursor(backend, cur_y, cur_x);
+    backend->present(backend);
 }